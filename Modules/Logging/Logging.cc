@@ -27,6 +27,8 @@ namespace Logging {
     constexpr const char *severityNameLookup[] = {"Info", "Warning", "Failure"};
     constexpr const char *severityColorLookup[] = {"\033[32m", "\033[33m", "\033[31m"}; //ANSI color codes
     constexpr bool meetsMinimumSeverity(Severity a, Severity b) { return static_cast<int>(a) >= static_cast<int>(b); }
+    //Worker threads log too, so console and file output are serialized.
+    std::mutex logMutex;
 
     template <Severity S, typename... Args>
     void log(std::format_string<Args...> fmt, Args&&... args) {
@@ -34,6 +36,7 @@ namespace Logging {
             return;
         }
 
+        std::lock_guard lock(logMutex);
         std::ofstream logFile;
         auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
         auto severityName = severityNameLookup[static_cast<int>(S)];
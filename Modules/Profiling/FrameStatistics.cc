@@ -0,0 +1,78 @@
+export module FrameStatistics;
+import std;
+import Logging;
+
+export namespace Profiling {
+
+    //Collects per frame timings for a benchmark run and reports a summary, IE:
+    //Logging::info output "Headless: 1000 frames, 2412.7 fps | frame ms min 0.301 avg 0.414 p50 0.398 p99 0.702 max 1.950 | ..."
+    struct FrameStatistics {
+        std::vector<double> frameMilliseconds;
+        std::vector<double> gpuMilliseconds;
+        std::vector<double> descriptorMicroseconds;
+
+        void reserve(size_t frames) {
+            frameMilliseconds.reserve(frames);
+            gpuMilliseconds.reserve(frames);
+            descriptorMicroseconds.reserve(frames);
+        }
+
+        void record(std::chrono::duration<double> frameTime, std::chrono::duration<double> gpuTime) {
+            frameMilliseconds.push_back(frameTime.count() * 1000.0);
+            //Zero means the GPU time was not measured for this frame (no timestamp support, or not ready yet).
+            if (gpuTime.count() > 0.0) {
+                gpuMilliseconds.push_back(gpuTime.count() * 1000.0);
+            }
+        }
+
+        //CPU time spent getting the frame's descriptors ready, whichever backend provides them.
+        void recordDescriptors(std::chrono::duration<double> descriptorTime) {
+            descriptorMicroseconds.push_back(descriptorTime.count() * 1000000.0);
+        }
+
+        void report(std::string_view label) const {
+            if (frameMilliseconds.empty()) {
+                Logging::warning("{}: no frames recorded.", label);
+                return;
+            }
+
+            auto frame = summarize(frameMilliseconds);
+            double totalSeconds = std::accumulate(frameMilliseconds.begin(), frameMilliseconds.end(), 0.0) / 1000.0;
+            Logging::info("{}: {} frames, {:.1f} fps | frame ms min {:.3f} avg {:.3f} p50 {:.3f} p99 {:.3f} max {:.3f}",
+                label, frameMilliseconds.size(), frameMilliseconds.size() / totalSeconds,
+                frame.min, frame.mean, frame.p50, frame.p99, frame.max);
+
+            if (!descriptorMicroseconds.empty()) {
+                auto descriptors = summarize(descriptorMicroseconds);
+                Logging::info("{}: descriptor us min {:.2f} avg {:.2f} p50 {:.2f} p99 {:.2f} max {:.2f}",
+                    label, descriptors.min, descriptors.mean, descriptors.p50, descriptors.p99, descriptors.max);
+            }
+
+            if (gpuMilliseconds.empty()) {
+                return;
+            }
+            auto gpu = summarize(gpuMilliseconds);
+            Logging::info("{}: gpu ms min {:.3f} avg {:.3f} p50 {:.3f} p99 {:.3f} max {:.3f}",
+                label, gpu.min, gpu.mean, gpu.p50, gpu.p99, gpu.max);
+        }
+
+    private:
+        struct Summary {
+            double min;
+            double mean;
+            double p50;
+            double p99;
+            double max;
+        };
+
+        static Summary summarize(std::vector<double> samples) {
+            std::ranges::sort(samples);
+            auto percentile = [&samples](double fraction) {
+                return samples[static_cast<size_t>(fraction * (samples.size() - 1))];
+            };
+            double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+            return {samples.front(), mean, percentile(0.5), percentile(0.99), samples.back()};
+        }
+    };
+
+}
@@ -0,0 +1,54 @@
+export module ShaderCode;
+
+import std;
+import Logging;
+import EmbeddedShaders;
+
+/*
+    Finds SPIR-V for a shader path. Shaders embedded at build time are used in place from rodata, anything else
+    (or everything, when preferDisk is set for hot reload) is read from disk relative to the working directory.
+*/
+
+export namespace Shaders {
+
+    struct SpirvCode {
+        //Only holds data for shaders read from disk. Moving a vector keeps its buffer, so words stays valid.
+        std::vector<std::uint32_t> storage;
+        std::span<const std::uint32_t> words;
+    };
+
+    std::optional<SpirvCode> loadSpirv(const std::filesystem::path& path, bool preferDisk = false);
+
+}
+
+namespace Shaders {
+    std::optional<SpirvCode> loadSpirv(const std::filesystem::path& path, bool preferDisk) {
+        if (!preferDisk) {
+            auto key = path.lexically_normal().generic_string();
+            for (const auto& shader : embeddedShaders) {
+                if (shader.path == key) {
+                    return SpirvCode{{}, shader.code};
+                }
+            }
+        }
+
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) {
+            Logging::failure("Couldn't find shader {}.", path.string());
+            return {};
+        }
+
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        if (fileSize == 0 || fileSize % sizeof(std::uint32_t) != 0) {
+            Logging::failure("{} isn't a SPIR-V binary.", path.string());
+            return {};
+        }
+
+        SpirvCode code;
+        code.storage.resize(fileSize / sizeof(std::uint32_t));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(code.storage.data()), static_cast<std::streamsize>(fileSize));
+        code.words = code.storage;
+        return code;
+    }
+}
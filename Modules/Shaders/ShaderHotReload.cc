@@ -0,0 +1,194 @@
+module;
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+export module ShaderHotReload;
+
+import std;
+import Logging;
+
+/*
+    Development mode shader reloading.
+
+    A background thread watches the shader source directory with inotify and recompiles changed sources with glslc,
+    the same way shaders.sh does. Output goes to a temporary file first and is renamed into place, so a pipeline
+    compiling at the same moment never reads half a SPIR-V file and a failed compile keeps the last good one.
+    The render loop collects rebuilt SPIR-V paths with takeRebuilt() and hands them to PipelineCompiler::reload.
+*/
+
+export namespace Shaders {
+
+    struct ShaderSource {
+        std::filesystem::path source;
+        std::filesystem::path spirv;
+    };
+
+    struct ShaderWatcher {
+        std::vector<ShaderSource> shaders;
+        std::string compiler{"glslc"};
+
+        int inotifyDescriptor{-1};
+        //Written to by stop() to wake the watcher thread out of poll.
+        std::array<int, 2> stopPipe{-1, -1};
+        std::thread watcher;
+
+        std::mutex mutex;
+        std::vector<std::filesystem::path> rebuilt;
+
+        //Every source must live in the same directory, which is the one watched.
+        bool start(std::vector<ShaderSource> sources);
+        void stop();
+        //Wakes the watch thread through its stop pipe and joins it, see stop().
+        ~ShaderWatcher();
+
+        //Thread safe. Returns the SPIR-V files rebuilt since the last call.
+        std::vector<std::filesystem::path> takeRebuilt();
+
+        bool compile(const ShaderSource& shader) const;
+    };
+
+}
+
+namespace Shaders {
+    bool ShaderWatcher::start(std::vector<ShaderSource> sources) {
+        shaders = std::move(sources);
+        if (shaders.empty()) {
+            return false;
+        }
+        auto directory = shaders.front().source.parent_path();
+        if (directory.empty()) {
+            directory = ".";
+        }
+
+        inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyDescriptor < 0) {
+            Logging::failure("Couldn't initialize inotify for shader hot reload.");
+            return false;
+        }
+        //Editors either rewrite the file in place or write a new one and rename it over the old.
+        if (inotify_add_watch(inotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            Logging::failure("Couldn't watch {} for shader changes.", directory.string());
+            close(inotifyDescriptor);
+            inotifyDescriptor = -1;
+            return false;
+        }
+        if (pipe2(stopPipe.data(), O_CLOEXEC) < 0) {
+            Logging::failure("Couldn't create the shader watcher stop pipe.");
+            close(inotifyDescriptor);
+            inotifyDescriptor = -1;
+            return false;
+        }
+
+        watcher = std::thread([this]() {
+            alignas(inotify_event) std::array<char, 4096> buffer;
+            while (true) {
+                std::array<pollfd, 2> descriptors = {{
+                    {inotifyDescriptor, POLLIN, 0},
+                    {stopPipe[0], POLLIN, 0}
+                }};
+                if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+                    continue;
+                }
+                if (descriptors[1].revents & POLLIN) {
+                    return;
+                }
+
+                //One save usually produces several events, compile each changed source once per batch.
+                std::vector<const ShaderSource*> changed;
+                ssize_t length;
+                while ((length = read(inotifyDescriptor, buffer.data(), buffer.size())) > 0) {
+                    for (ssize_t offset = 0; offset < length;) {
+                        auto* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+                        offset += sizeof(inotify_event) + event->len;
+                        if (event->len == 0) {
+                            continue;
+                        }
+                        std::string_view name = event->name;
+                        for (const auto& shader : shaders) {
+                            if (shader.source.filename() == name && std::ranges::find(changed, &shader) == changed.end()) {
+                                changed.push_back(&shader);
+                            }
+                        }
+                    }
+                }
+
+                for (const auto* shader : changed) {
+                    if (compile(*shader)) {
+                        std::lock_guard lock(mutex);
+                        rebuilt.push_back(shader->spirv);
+                    }
+                }
+            }
+        });
+
+        Logging::info("Watching {} for shader changes.", directory.string());
+        return true;
+    }
+
+    void ShaderWatcher::stop() {
+        if (watcher.joinable()) {
+            char wake = 0;
+            ssize_t written;
+            do {
+                written = write(stopPipe[1], &wake, 1);
+            } while (written < 0 && errno == EINTR);
+            if (written == 1) {
+                watcher.join();
+            } else {
+                //Joining would wait on poll forever. The thread is left blocked until the process ends, with its
+                //descriptors kept open so it stays asleep.
+                Logging::failure("Couldn't wake the shader watcher to stop it: {}", std::strerror(errno));
+                watcher.detach();
+                return;
+            }
+        }
+        for (int& descriptor : stopPipe) {
+            if (descriptor >= 0) {
+                close(descriptor);
+                descriptor = -1;
+            }
+        }
+        if (inotifyDescriptor >= 0) {
+            close(inotifyDescriptor);
+            inotifyDescriptor = -1;
+        }
+    }
+
+    ShaderWatcher::~ShaderWatcher() {
+        stop();
+    }
+
+    std::vector<std::filesystem::path> ShaderWatcher::takeRebuilt() {
+        std::lock_guard lock(mutex);
+        return std::exchange(rebuilt, {});
+    }
+
+    bool ShaderWatcher::compile(const ShaderSource& shader) const {
+        auto temporaryPath = shader.spirv;
+        temporaryPath += ".tmp";
+
+        auto command = std::format("{} \"{}\" -o \"{}\"", compiler, shader.source.string(), temporaryPath.string());
+        auto compileStart = std::chrono::steady_clock::now();
+        if (std::system(command.c_str()) != 0) {
+            //glslc already printed the diagnostics.
+            Logging::warning("Shader {} failed to compile, keeping the previous SPIR-V.", shader.source.string());
+            std::error_code error;
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+        std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, shader.spirv, error);
+        if (error) {
+            Logging::failure("Couldn't replace {}: {}", shader.spirv.string(), error.message());
+            return false;
+        }
+
+        Logging::info("Recompiled {} in {:.1f} ms.", shader.source.string(), compileTime.count());
+        return true;
+    }
+}
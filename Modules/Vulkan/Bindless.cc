@@ -0,0 +1,288 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module Bindless;
+
+import std;
+import Logging;
+import PhysicalDevice;
+
+/*
+    A single global descriptor set holding large arrays of every sampled image and storage buffer, through
+    VK_EXT_descriptor_indexing. Resources are registered once and shaders find them by a 32-bit index, passed in
+    push constants or per instance data, so draws stop needing a descriptor set bind of their own:
+
+        layout(set = 1, binding = 0) uniform sampler2D textures[];
+        layout(set = 1, binding = 1) buffer Buffers { uint data[]; } buffers[];
+        ... texture(textures[nonuniformEXT(material.albedo)], uv) ...
+
+    The bindings are UPDATE_AFTER_BIND and PARTIALLY_BOUND, so slots can be filled while the set is bound in
+    command buffers that are still executing, as long as those command buffers never read the slot being written.
+    Released slots therefore wait out the frames in flight before being handed out again.
+*/
+
+export namespace Vulkan {
+
+    //Core in 1.2, on 1.1 it's an extension (its maintenance3 dependency is already core).
+    const std::vector<const char*> bindlessExtensions = {
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+    };
+
+    struct BindlessFeatures {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing{};
+
+        void* link(void* next) {
+            indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+            indexing.pNext = next;
+            indexing.runtimeDescriptorArray = VK_TRUE;
+            indexing.descriptorBindingPartiallyBound = VK_TRUE;
+            indexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+            indexing.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+            indexing.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+            indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            indexing.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+            return &indexing;
+        }
+    };
+
+    bool supportsBindless(VkPhysicalDevice physicalDevice);
+
+    struct BindlessTable {
+        static constexpr uint32_t setIndex = 1;
+        static constexpr uint32_t textureBinding = 0;
+        static constexpr uint32_t bufferBinding = 1;
+        static constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+        VkDescriptorSetLayout layout{VK_NULL_HANDLE};
+        VkDescriptorPool pool{VK_NULL_HANDLE};
+        VkDescriptorSet set{VK_NULL_HANDLE};
+
+        struct Slots {
+            uint32_t capacity{0};
+            uint32_t next{0};
+            std::vector<uint32_t> free;
+            //Index and the frame it was released on.
+            std::vector<std::pair<uint32_t, uint64_t>> released;
+
+            uint32_t take();
+            void collect(uint64_t frameNumber, uint32_t framesInFlight);
+        };
+        Slots textures;
+        Slots buffers;
+
+        //Requested capacities are clamped to the device's update after bind limits.
+        bool create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t maxTextures = 16384, uint32_t maxBuffers = 16384);
+
+        //invalidIndex once the table is full.
+        uint32_t registerTexture(VkDevice logicalDevice, VkImageView view, VkSampler sampler,
+            VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        uint32_t registerBuffer(VkDevice logicalDevice, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+        //The slot stays valid for frames already recorded and is reused framesInFlight frames later.
+        void releaseTexture(uint32_t index, uint64_t frameNumber);
+        void releaseBuffer(uint32_t index, uint64_t frameNumber);
+        void collectReleased(uint64_t frameNumber, uint32_t framesInFlight);
+
+        //Once per command buffer, for any pipeline whose layout was built with this table at setIndex.
+        void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout) const;
+
+        void destroy(VkDevice logicalDevice);
+    };
+
+}
+
+namespace Vulkan {
+    bool supportsBindless(VkPhysicalDevice physicalDevice) {
+        if (!checkDeviceExtensionSupport(physicalDevice, bindlessExtensions)) {
+            return false;
+        }
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing{};
+        indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &indexing;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        return indexing.runtimeDescriptorArray == VK_TRUE &&
+            indexing.descriptorBindingPartiallyBound == VK_TRUE &&
+            indexing.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+            indexing.descriptorBindingStorageBufferUpdateAfterBind == VK_TRUE &&
+            indexing.descriptorBindingUpdateUnusedWhilePending == VK_TRUE &&
+            indexing.shaderSampledImageArrayNonUniformIndexing == VK_TRUE &&
+            indexing.shaderStorageBufferArrayNonUniformIndexing == VK_TRUE;
+    }
+
+    uint32_t BindlessTable::Slots::take() {
+        if (!free.empty()) {
+            uint32_t index = free.back();
+            free.pop_back();
+            return index;
+        }
+        return next < capacity ? next++ : invalidIndex;
+    }
+
+    void BindlessTable::Slots::collect(uint64_t frameNumber, uint32_t framesInFlight) {
+        std::erase_if(released, [&](const auto& slot) {
+            if (slot.second + framesInFlight > frameNumber) {
+                return false;
+            }
+            free.push_back(slot.first);
+            return true;
+        });
+    }
+
+    bool BindlessTable::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t maxTextures, uint32_t maxBuffers) {
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+        indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &indexingProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        textures.capacity = std::min({maxTextures,
+            indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+            indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+            indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers});
+        buffers.capacity = std::min({maxBuffers,
+            indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+            indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0].binding = textureBinding;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = textures.capacity;
+        bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+        bindings[1].binding = bufferBinding;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = buffers.capacity;
+        bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+        constexpr VkDescriptorBindingFlagsEXT bindlessFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+        std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags{bindlessFlags, bindlessFlags};
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+        bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+        bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext = &bindingFlagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+        if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the bindless descriptor set layout.");
+            return false;
+        }
+
+        std::array<VkDescriptorPoolSize, 2> poolSizes{{
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textures.capacity},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffers.capacity}
+        }};
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the bindless descriptor pool.");
+            return false;
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &layout;
+        if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &set) != VK_SUCCESS) {
+            Logging::failure("Couldn't allocate the bindless descriptor set.");
+            return false;
+        }
+
+        Logging::info("Bindless table with {} textures and {} storage buffers.", textures.capacity, buffers.capacity);
+        return true;
+    }
+
+    uint32_t BindlessTable::registerTexture(VkDevice logicalDevice, VkImageView view, VkSampler sampler, VkImageLayout imageLayout) {
+        uint32_t index = textures.take();
+        if (index == invalidIndex) {
+            Logging::warning("The bindless texture table is full.");
+            return invalidIndex;
+        }
+
+        VkDescriptorImageInfo imageInfo{sampler, view, imageLayout};
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set;
+        write.dstBinding = textureBinding;
+        write.dstArrayElement = index;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.descriptorCount = 1;
+        write.pImageInfo = &imageInfo;
+        vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+        return index;
+    }
+
+    uint32_t BindlessTable::registerBuffer(VkDevice logicalDevice, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+        uint32_t index = buffers.take();
+        if (index == invalidIndex) {
+            Logging::warning("The bindless buffer table is full.");
+            return invalidIndex;
+        }
+
+        VkDescriptorBufferInfo bufferInfo{buffer, offset, range};
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set;
+        write.dstBinding = bufferBinding;
+        write.dstArrayElement = index;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.descriptorCount = 1;
+        write.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+        return index;
+    }
+
+    void BindlessTable::releaseTexture(uint32_t index, uint64_t frameNumber) {
+        if (index != invalidIndex) {
+            textures.released.emplace_back(index, frameNumber);
+        }
+    }
+
+    void BindlessTable::releaseBuffer(uint32_t index, uint64_t frameNumber) {
+        if (index != invalidIndex) {
+            buffers.released.emplace_back(index, frameNumber);
+        }
+    }
+
+    void BindlessTable::collectReleased(uint64_t frameNumber, uint32_t framesInFlight) {
+        textures.collect(frameNumber, framesInFlight);
+        buffers.collect(frameNumber, framesInFlight);
+    }
+
+    void BindlessTable::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout) const {
+        vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, setIndex, 1, &set, 0, nullptr);
+    }
+
+    void BindlessTable::destroy(VkDevice logicalDevice) {
+        //The set goes with its pool.
+        if (pool != VK_NULL_HANDLE) {
+            vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+            pool = VK_NULL_HANDLE;
+        }
+        if (layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(logicalDevice, layout, nullptr);
+            layout = VK_NULL_HANDLE;
+        }
+        set = VK_NULL_HANDLE;
+        textures = {};
+        buffers = {};
+    }
+}
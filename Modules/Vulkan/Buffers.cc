@@ -10,7 +10,8 @@ import Descriptors;
 import Logging;
 
 namespace Vulkan {
-    static uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    //Returns UINT32_MAX (-1) when no memory type matches.
+    export uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
         VkPhysicalDeviceMemoryProperties memProperties;
         vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
 
@@ -22,9 +23,12 @@ namespace Vulkan {
         return -1;
     }
 
-    export std::tuple<VkBuffer, VkDeviceMemory> createBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
-        VkBuffer buffer;
-        VkDeviceMemory bufferMemory;
+    //allocateFlags is for DEVICE_ADDRESS, which buffers with SHADER_DEVICE_ADDRESS usage need.
+    export std::tuple<VkBuffer, VkDeviceMemory> createBuffer(
+        VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+        VkMemoryAllocateFlags allocateFlags = 0) {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
 
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -42,6 +46,13 @@ namespace Vulkan {
         allocInfo.allocationSize = memRequirements.size;
         allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
 
+        VkMemoryAllocateFlagsInfo allocFlagsInfo{};
+        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        allocFlagsInfo.flags = allocateFlags;
+        if (allocateFlags != 0) {
+            allocInfo.pNext = &allocFlagsInfo;
+        }
+
         vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &bufferMemory);
         vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
 
@@ -90,15 +101,17 @@ namespace Vulkan {
     export struct UniformBuffer {
         VkBuffer buffer;
         VkDeviceMemory bufferMemory;
-        VkDescriptorSet descriptorSet;
+        VkDescriptorSet descriptorSet{VK_NULL_HANDLE};
         void* bufferData;
 
-        void allocate(VkPhysicalDevice physicalDevice, VkDevice logicalDevice) {
+        //deviceAddress for descriptor buffers, which reference the buffer by address.
+        void allocate(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, bool deviceAddress = false) {
             VkDeviceSize bufferSize = sizeof(Descriptors::UniformBufferObject);
             std::tie(buffer, bufferMemory) = createBuffer(
                 physicalDevice, logicalDevice, bufferSize, 
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | (deviceAddress ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR : 0), 
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                deviceAddress ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR : 0);
 
             vkMapMemory(logicalDevice, bufferMemory, 0, bufferSize, 0, &bufferData);
         }
@@ -108,27 +121,11 @@ namespace Vulkan {
             vkFreeMemory(logicalDevice, bufferMemory, nullptr);
         }
 
-        void bindDescriptor(VkDevice logicalDevice, VkDescriptorSet descriptorSet) {
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = buffer;
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(Descriptors::UniformBufferObject);
-            this->descriptorSet = descriptorSet;
-
-            VkWriteDescriptorSet descriptorWrite{};
-            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrite.dstSet = this->descriptorSet;
-            descriptorWrite.dstBinding = 0;
-            descriptorWrite.dstArrayElement = 0;
-
-            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrite.descriptorCount = 1;
-
-            descriptorWrite.pBufferInfo = &bufferInfo;
-            descriptorWrite.pImageInfo = nullptr; // Optional
-            descriptorWrite.pTexelBufferView = nullptr; // Optional
-
-            vkUpdateDescriptorSets(logicalDevice, 1, &descriptorWrite, 0, nullptr);
+        //Binding 0 of the uniform set, resolved to a VkDescriptorSet through a DescriptorSetCache.
+        Descriptors::DescriptorWriter descriptorWrites() const {
+            Descriptors::DescriptorWriter writes;
+            writes.uniformBuffer(0, buffer, sizeof(Descriptors::UniformBufferObject));
+            return writes;
         }
 
         void updateUniformBuffer(VkExtent2D swapChainExtent) {
@@ -160,6 +157,15 @@ namespace Vulkan {
         int numIndices;
         void* bufferData;
 
+        //One stream for interleaved vertices from put, two (positions then attributes) from putStreams.
+        std::array<VkDeviceSize, 2> streamOffsets{};
+        uint32_t streamCount{1};
+        VkDeviceSize indexOffset{0};
+
+        static constexpr VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
         VkDevice allocatedDevice;
         bool mapped{false};
 
@@ -216,6 +222,56 @@ namespace Vulkan {
             std::memcpy(bufferData, vertices.data(), (size_t) vertexSize);
             void* indexDest = reinterpret_cast<std::byte*>(bufferData) + vertexSize;
             std::memcpy(indexDest, indices.data(),  (size_t) indexSize);
+
+            streamOffsets = {0, 0};
+            streamCount = 1;
+            indexOffset = vertexSize;
+        }
+
+        //Positions and the remaining attributes as separate streams in the same allocation, followed by the indices.
+        //Position only passes bind just the first stream and the positions are contiguous for SIMD processing.
+        template <Descriptors::VertexStruct Position, Descriptors::VertexStruct Attributes>
+        void putStreams(std::span<const Position> positions, std::span<const Attributes> attributes, std::span<const uint16_t> indices) {
+            if (!mapped) {
+                Logging::failure("Attempted to put vertex streams into an unmapped staged buffer.");
+                return;
+            }
+            if (positions.size() != attributes.size()) {
+                Logging::failure("Vertex streams have {} positions and {} attributes.", positions.size(), attributes.size());
+                return;
+            }
+            VkDeviceSize positionSize = positions.size_bytes();
+            VkDeviceSize attributeSize = attributes.size_bytes();
+            //Streams start on 16 bytes so every attribute format is aligned, index offsets have to be a multiple of the index size.
+            std::array<VkDeviceSize, 2> offsets{0, alignUp(positionSize, 16)};
+            VkDeviceSize indicesAt = alignUp(offsets[1] + attributeSize, 4);
+            //Checked before anything changes, so a failed put leaves the previous streams whole and drawable.
+            if (indicesAt + indices.size_bytes() > bufferSize) {
+                Logging::failure("Vertex streams need {} bytes, the staged buffer holds {}.", indicesAt + indices.size_bytes(), bufferSize);
+                return;
+            }
+
+            streamOffsets = offsets;
+            streamCount = 2;
+            indexOffset = indicesAt;
+            vertexSize = positionSize + attributeSize;
+            indexSize = indices.size_bytes();
+            numVertices = positions.size();
+            numIndices = indices.size();
+
+            auto* destination = reinterpret_cast<std::byte*>(bufferData);
+            std::memcpy(destination + streamOffsets[0], positions.data(), (size_t) positionSize);
+            std::memcpy(destination + streamOffsets[1], attributes.data(), (size_t) attributeSize);
+            std::memcpy(destination + indexOffset, indices.data(), (size_t) indexSize);
+        }
+
+        //Binds the vertex streams from binding 0 and the index buffer. positionsOnly binds just binding 0, for
+        //pipelines using VertexLayout::of<Descriptors::VertexPosition>.
+        void bind(VkCommandBuffer commandBuffer, bool positionsOnly = false) const {
+            std::array<VkBuffer, 2> buffers{buffer, buffer};
+            uint32_t count = positionsOnly ? 1 : streamCount;
+            vkCmdBindVertexBuffers(commandBuffer, 0, count, buffers.data(), streamOffsets.data());
+            vkCmdBindIndexBuffer(commandBuffer, buffer, indexOffset, VK_INDEX_TYPE_UINT16);
         }
 
         void stagingToBuffer(VkQueue commandQueue, VkCommandPool commandPool) {
@@ -9,6 +9,10 @@ import Queues;
 import Logging;
 import Descriptors;
 import Buffers;
+import ShaderObjects;
+import ComputePipeline;
+import DescriptorBuffer;
+import DescriptorTemplates;
 
 export namespace Vulkan {
     VkCommandPool createCommandPool(VkPhysicalDevice physicalDevice, VkDevice logicalDevice);
@@ -23,7 +27,45 @@ export namespace Vulkan {
         std::vector<VkFramebuffer> swapChainFramebuffers, 
         VkExtent2D swapChainExtent,
         const Vulkan::StagedBuffer& stagedVertexBuffer,
-        Vulkan::UniformBuffer& uniformBuffer
+        Vulkan::UniformBuffer& uniformBuffer,
+        VkQueryPool timestampQueries = VK_NULL_HANDLE,
+        uint32_t firstTimestampQuery = 0,
+        //Draws with VK_EXT_shader_object and dynamic rendering instead of graphicsPipeline and renderPass.
+        const ShaderObjectDraw* shaderObjects = nullptr,
+        //Binds set 0 from a descriptor buffer instead of uniformBuffer.descriptorSet.
+        const DescriptorBufferBinding* descriptorBuffer = nullptr,
+        //Pushes set 0 with VK_KHR_push_descriptor instead of binding uniformBuffer.descriptorSet.
+        const PushDescriptorBinding* pushDescriptors = nullptr
+    );
+
+    //The producer and consumer pairs that come up around compute work, each maps to one stage and access mask pair.
+    enum class ComputeBarrier {
+        ComputeToCompute,
+        ComputeToVertexInput,
+        ComputeToIndexInput,
+        ComputeToIndirect,
+        ComputeToFragment,
+        ComputeToTransfer,
+        GraphicsToCompute,
+        TransferToCompute
+    };
+
+    void bindComputePipeline(VkCommandBuffer commandBuffer, const ComputePipeline& compute, std::span<const VkDescriptorSet> descriptorSets = {});
+    void pushComputeConstants(VkCommandBuffer commandBuffer, const ComputePipeline& compute, std::span<const std::byte> data, uint32_t offset = 0);
+    void dispatch(VkCommandBuffer commandBuffer, uint32_t groupsX, uint32_t groupsY = 1, uint32_t groupsZ = 1);
+    //Groups come from the buffer as a VkDispatchIndirectCommand, IE written by an earlier compute pass.
+    void dispatchIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset = 0);
+
+    //Global memory barrier, covers every buffer written by the producer.
+    void computeBarrier(VkCommandBuffer commandBuffer, ComputeBarrier barrier);
+    //Same dependency for an image, transitioning its layout, IE GENERAL for a storage image to SHADER_READ_ONLY_OPTIMAL.
+    void computeImageBarrier(
+        VkCommandBuffer commandBuffer,
+        ComputeBarrier barrier,
+        VkImage image,
+        VkImageLayout oldLayout,
+        VkImageLayout newLayout,
+        VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}
     );
 }
 
@@ -57,7 +99,9 @@ namespace Vulkan {
     bool recordCommandBuffer(
         VkCommandBuffer commandBuffer, uint32_t imageIndex, VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout,
         VkRenderPass renderPass, std::vector<VkFramebuffer> swapChainFramebuffers, VkExtent2D swapChainExtent,
-        const Vulkan::StagedBuffer& stagedVertexBuffer, Vulkan::UniformBuffer& uniformBuffer) {
+        const Vulkan::StagedBuffer& stagedVertexBuffer, Vulkan::UniformBuffer& uniformBuffer,
+        VkQueryPool timestampQueries, uint32_t firstTimestampQuery, const ShaderObjectDraw* shaderObjects,
+        const DescriptorBufferBinding* descriptorBuffer, const PushDescriptorBinding* pushDescriptors) {
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -66,44 +110,194 @@ namespace Vulkan {
             return false;
         }
 
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapChainExtent;
+        //Optional GPU timing, brackets the whole frame with a top and bottom of pipe timestamp.
+        if (timestampQueries != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, timestampQueries, firstTimestampQuery, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueries, firstTimestampQuery);
+        }
 
         VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColor;
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        if (shaderObjects != nullptr) {
+            //No render pass to transition the image, so the barriers it implied are recorded by hand.
+            VkImageMemoryBarrier toAttachment{};
+            toAttachment.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            toAttachment.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            toAttachment.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            toAttachment.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            toAttachment.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toAttachment.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toAttachment.image = shaderObjects->targetImage;
+            toAttachment.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &toAttachment);
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+            VkRenderingAttachmentInfoKHR colorAttachment{};
+            colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+            colorAttachment.imageView = shaderObjects->targetView;
+            colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            colorAttachment.clearValue = clearColor;
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float)swapChainExtent.width;
-        viewport.height = (float)swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            VkRenderingInfoKHR renderingInfo{};
+            renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+            renderingInfo.renderArea = {{0, 0}, swapChainExtent};
+            renderingInfo.layerCount = 1;
+            renderingInfo.colorAttachmentCount = 1;
+            renderingInfo.pColorAttachments = &colorAttachment;
+            shaderObjects->functions->beginRendering(commandBuffer, &renderingInfo);
+        } else {
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = swapChainExtent;
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
+
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        bool drawWithShaderObjects = shaderObjects != nullptr && shaderObjects->shaders.valid();
+        if (drawWithShaderObjects) {
+            bindShaderObjects(*shaderObjects->functions, commandBuffer, shaderObjects->shaders);
+            setDynamicState(*shaderObjects->functions, commandBuffer, *shaderObjects->state, swapChainExtent);
+        }
 
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = swapChainExtent;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        //Pipelines compile asynchronously, until this one is ready the frame is just cleared.
+        if (drawWithShaderObjects || (shaderObjects == nullptr && graphicsPipeline != VK_NULL_HANDLE)) {
+            if (!drawWithShaderObjects) {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-        VkBuffer vertexBuffers[] = {stagedVertexBuffer.buffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(commandBuffer, stagedVertexBuffer.buffer, stagedVertexBuffer.vertexSize, VK_INDEX_TYPE_UINT16);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &uniformBuffer.descriptorSet, 0, nullptr);
-        vkCmdDrawIndexed(commandBuffer, stagedVertexBuffer.numIndices, 1, 0, 0, 0);
+                VkViewport viewport{};
+                viewport.x = 0.0f;
+                viewport.y = 0.0f;
+                viewport.width = (float)swapChainExtent.width;
+                viewport.height = (float)swapChainExtent.height;
+                viewport.minDepth = 0.0f;
+                viewport.maxDepth = 1.0f;
+                vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-        vkCmdEndRenderPass(commandBuffer);
+                VkRect2D scissor{};
+                scissor.offset = {0, 0};
+                scissor.extent = swapChainExtent;
+                vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            }
+
+            stagedVertexBuffer.bind(commandBuffer);
+            if (descriptorBuffer != nullptr) {
+                descriptorBuffer->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout);
+            } else if (pushDescriptors != nullptr) {
+                pushDescriptors->push(commandBuffer);
+            } else {
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &uniformBuffer.descriptorSet, 0, nullptr);
+            }
+            vkCmdDrawIndexed(commandBuffer, stagedVertexBuffer.numIndices, 1, 0, 0, 0);
+        }
+
+        if (shaderObjects != nullptr) {
+            shaderObjects->functions->endRendering(commandBuffer);
+
+            VkImageMemoryBarrier toPresent{};
+            toPresent.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            toPresent.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            toPresent.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            toPresent.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toPresent.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toPresent.image = shaderObjects->targetImage;
+            toPresent.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &toPresent);
+        } else {
+            vkCmdEndRenderPass(commandBuffer);
+        }
+
+        if (timestampQueries != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueries, firstTimestampQuery + 1);
+        }
 
         return vkEndCommandBuffer(commandBuffer) != VK_SUCCESS;
     }
-}
\ No newline at end of file
+
+    void bindComputePipeline(VkCommandBuffer commandBuffer, const ComputePipeline& compute, std::span<const VkDescriptorSet> descriptorSets) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+        if (!descriptorSets.empty()) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.layout, 0,
+                static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+        }
+    }
+
+    void pushComputeConstants(VkCommandBuffer commandBuffer, const ComputePipeline& compute, std::span<const std::byte> data, uint32_t offset) {
+        vkCmdPushConstants(commandBuffer, compute.layout, VK_SHADER_STAGE_COMPUTE_BIT, offset, static_cast<uint32_t>(data.size()), data.data());
+    }
+
+    void dispatch(VkCommandBuffer commandBuffer, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) {
+        vkCmdDispatch(commandBuffer, groupsX, groupsY, groupsZ);
+    }
+
+    void dispatchIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset) {
+        vkCmdDispatchIndirect(commandBuffer, buffer, offset);
+    }
+
+    struct BarrierScope {
+        VkPipelineStageFlags srcStage;
+        VkAccessFlags srcAccess;
+        VkPipelineStageFlags dstStage;
+        VkAccessFlags dstAccess;
+    };
+
+    BarrierScope barrierScope(ComputeBarrier barrier) {
+        constexpr auto compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        constexpr auto graphics = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        switch (barrier) {
+            case ComputeBarrier::ComputeToCompute:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, compute, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+            case ComputeBarrier::ComputeToVertexInput:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT};
+            case ComputeBarrier::ComputeToIndexInput:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT};
+            case ComputeBarrier::ComputeToIndirect:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+            case ComputeBarrier::ComputeToFragment:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT};
+            case ComputeBarrier::ComputeToTransfer:
+                return {compute, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT};
+            case ComputeBarrier::GraphicsToCompute:
+                return {graphics, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    compute, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+            case ComputeBarrier::TransferToCompute:
+                return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, compute, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        }
+        return {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT};
+    }
+
+    void computeBarrier(VkCommandBuffer commandBuffer, ComputeBarrier barrier) {
+        auto scope = barrierScope(barrier);
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = scope.srcAccess;
+        memoryBarrier.dstAccessMask = scope.dstAccess;
+        vkCmdPipelineBarrier(commandBuffer, scope.srcStage, scope.dstStage, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    void computeImageBarrier(
+        VkCommandBuffer commandBuffer, ComputeBarrier barrier, VkImage image,
+        VkImageLayout oldLayout, VkImageLayout newLayout, VkImageSubresourceRange range) {
+        auto scope = barrierScope(barrier);
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = scope.srcAccess;
+        imageBarrier.dstAccessMask = scope.dstAccess;
+        imageBarrier.oldLayout = oldLayout;
+        imageBarrier.newLayout = newLayout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = image;
+        imageBarrier.subresourceRange = range;
+        vkCmdPipelineBarrier(commandBuffer, scope.srcStage, scope.dstStage, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+    }
+}
@@ -0,0 +1,145 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module ComputePipeline;
+
+import std;
+import Logging;
+import PipelineCache;
+import PipelineState;
+import ShaderCode;
+import ShaderReflection;
+
+/*
+    Compute pipelines built from a single SPIR-V file. The descriptor set and pipeline layouts come from
+    reflecting the shader (shared through the ShaderReflectionCache), as does the workgroup size used to work
+    out dispatch sizes. Recording dispatches and the barriers around them lives in Commands.
+*/
+
+export namespace Vulkan {
+
+    struct ComputePipeline {
+        VkPipeline pipeline{VK_NULL_HANDLE};
+        //Owned by the ShaderReflectionCache the pipeline was created with.
+        VkPipelineLayout layout{VK_NULL_HANDLE};
+        std::vector<VkDescriptorSetLayout> setLayouts;
+        ShaderReflection reflection;
+
+        bool valid() const {
+            return pipeline != VK_NULL_HANDLE;
+        }
+
+        //Workgroups needed to cover this many invocations along each axis.
+        std::array<uint32_t, 3> groupCount(uint32_t x, uint32_t y = 1, uint32_t z = 1) const {
+            return {
+                (x + reflection.localSize[0] - 1) / reflection.localSize[0],
+                (y + reflection.localSize[1] - 1) / reflection.localSize[1],
+                (z + reflection.localSize[2] - 1) / reflection.localSize[2]
+            };
+        }
+
+        void destroy(VkDevice logicalDevice) {
+            if (pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+                pipeline = VK_NULL_HANDLE;
+            }
+        }
+    };
+
+    ComputePipeline createComputePipeline(
+        VkDevice logicalDevice,
+        const std::filesystem::path& shaderPath,
+        ShaderReflectionCache& reflections,
+        const PipelineCache& pipelineCache,
+        const SpecializationConstants& constants = {},
+        bool preferDiskShaders = false,
+        VkPipelineCreateFlags flags = 0
+    );
+
+}
+
+namespace Vulkan {
+    ComputePipeline createComputePipeline(
+        VkDevice logicalDevice,
+        const std::filesystem::path& shaderPath,
+        ShaderReflectionCache& reflections,
+        const PipelineCache& pipelineCache,
+        const SpecializationConstants& constants,
+        bool preferDiskShaders,
+        VkPipelineCreateFlags flags) {
+        ComputePipeline compute;
+
+        auto code = Shaders::loadSpirv(shaderPath, preferDiskShaders);
+        if (!code) {
+            Logging::failure("Couldn't find or use compute shader {}.", shaderPath.string());
+            return compute;
+        }
+
+        const auto* reflection = reflections.reflect(code->words);
+        if (reflection == nullptr || !(reflection->stages & VK_SHADER_STAGE_COMPUTE_BIT)) {
+            Logging::failure("{} isn't a compute shader.", shaderPath.string());
+            return compute;
+        }
+        compute.reflection = *reflection;
+        //A local_size_x_id dimension takes whatever this pipeline specializes it to, not the shader's default.
+        for (size_t axis = 0; axis < 3; axis++) {
+            uint32_t constantId = compute.reflection.localSizeConstantIds[axis];
+            if (constantId == UINT32_MAX) {
+                continue;
+            }
+            if (auto size = constants.value(constantId); size && size.value() != 0) {
+                compute.reflection.localSize[axis] = size.value();
+            }
+        }
+        compute.setLayouts = reflections.descriptorSetLayouts(logicalDevice, compute.reflection);
+        compute.layout = reflections.pipelineLayout(logicalDevice, compute.reflection);
+        if (compute.layout == VK_NULL_HANDLE) {
+            Logging::failure("Couldn't create the layout for compute shader {}.", shaderPath.string());
+            return compute;
+        }
+
+        VkShaderModuleCreateInfo moduleInfo{};
+        moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        moduleInfo.codeSize = code->words.size_bytes();
+        moduleInfo.pCode = code->words.data();
+
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        if (vkCreateShaderModule(logicalDevice, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+            Logging::failure("Couldn't create a shader module for {}.", shaderPath.string());
+            return compute;
+        }
+
+        VkSpecializationInfo specializationInfo = constants.info();
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.flags = flags;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.stage.pSpecializationInfo = constants.empty() ? nullptr : &specializationInfo;
+        pipelineInfo.layout = compute.layout;
+
+        PipelineCreationFeedback feedback;
+        if (pipelineCache.creationFeedbackEnabled) {
+            pipelineInfo.pNext = feedback.link(pipelineInfo.pNext, 1);
+        }
+
+        auto compileStart = std::chrono::steady_clock::now();
+        vkCreateComputePipelines(logicalDevice, pipelineCache.vulkanCache, 1, &pipelineInfo, nullptr, &compute.pipeline);
+        std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
+        vkDestroyShaderModule(logicalDevice, shaderModule, nullptr);
+
+        auto name = shaderPath.filename().string();
+        if (compute.pipeline == VK_NULL_HANDLE) {
+            Logging::failure("Failed to create compute pipeline {}.", name);
+        } else if (pipelineCache.creationFeedbackEnabled) {
+            feedback.log(name);
+        } else {
+            Logging::info("Pipeline {}: {:.3f} ms.", name, compileTime.count());
+        }
+        return compute;
+    }
+}
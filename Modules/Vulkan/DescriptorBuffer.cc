@@ -0,0 +1,333 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module DescriptorBuffer;
+
+import std;
+import Logging;
+import PhysicalDevice;
+import Buffers;
+import Descriptors;
+import DescriptorCache;
+
+/*
+    Optional VK_EXT_descriptor_buffer backend.
+
+    Rather than allocating sets from pools and writing them with vkUpdateDescriptorSets, descriptors are written
+    with vkGetDescriptorEXT straight into a host visible buffer, and a set is just an offset into it. There is
+    nothing to allocate or free on the CPU; each frame writes its sets into its own region of the buffer, which is
+    reused once that frame's fence has signalled. A region remembers what it holds, so a frame requesting the same
+    sets in the same order as last time round skips vkGetDescriptorEXT, just as DescriptorSetCache skips
+    vkUpdateDescriptorSets. Like the cache, call clear() once a referenced buffer or image is destroyed.
+
+    Every set layout has to be created with DESCRIPTOR_BUFFER and every pipeline with the matching pipeline flag,
+    see ShaderReflectionCache::setLayoutFlags and PipelineCompiler::pipelineFlags. Buffers referenced by
+    descriptors need a device address.
+*/
+
+export namespace Vulkan {
+
+    //Descriptor buffers need buffer device addresses and synchronization2, both core in 1.3 and extensions on 1.1.
+    const std::vector<const char*> descriptorBufferExtensions = {
+        VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
+        VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+        VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME
+    };
+
+    struct DescriptorBufferFeatures {
+        VkPhysicalDeviceBufferDeviceAddressFeaturesKHR bufferDeviceAddress{};
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{};
+        VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBuffer{};
+
+        void* link(void* next) {
+            descriptorBuffer.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+            descriptorBuffer.pNext = next;
+            descriptorBuffer.descriptorBuffer = VK_TRUE;
+            synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+            synchronization2.pNext = &descriptorBuffer;
+            synchronization2.synchronization2 = VK_TRUE;
+            bufferDeviceAddress.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+            bufferDeviceAddress.pNext = &synchronization2;
+            bufferDeviceAddress.bufferDeviceAddress = VK_TRUE;
+            return &bufferDeviceAddress;
+        }
+    };
+
+    bool supportsDescriptorBuffers(VkPhysicalDevice physicalDevice);
+
+    //Extension entry points, none of these are exported by the 1.1 loader.
+    struct DescriptorBufferFunctions {
+        PFN_vkGetDescriptorSetLayoutSizeEXT getLayoutSize{nullptr};
+        PFN_vkGetDescriptorSetLayoutBindingOffsetEXT getBindingOffset{nullptr};
+        PFN_vkGetDescriptorEXT getDescriptor{nullptr};
+        PFN_vkCmdBindDescriptorBuffersEXT bindDescriptorBuffers{nullptr};
+        PFN_vkCmdSetDescriptorBufferOffsetsEXT setDescriptorBufferOffsets{nullptr};
+        PFN_vkGetBufferDeviceAddressKHR getBufferDeviceAddress{nullptr};
+
+        bool load(VkDevice logicalDevice);
+    };
+
+    //A set written into a descriptor buffer, bound in place of vkCmdBindDescriptorSets.
+    struct DescriptorBufferBinding {
+        const DescriptorBufferFunctions* functions{nullptr};
+        VkDeviceAddress address{0};
+        VkBufferUsageFlags usage{0};
+        VkDeviceSize offset{0};
+
+        void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t set = 0) const;
+    };
+
+    struct DescriptorBuffer {
+        static constexpr VkBufferUsageFlags usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+            VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+
+        VkBuffer buffer{VK_NULL_HANDLE};
+        VkDeviceMemory memory{VK_NULL_HANDLE};
+        std::byte* mapped{nullptr};
+        VkDeviceAddress address{0};
+        VkPhysicalDeviceDescriptorBufferPropertiesEXT properties{};
+        const DescriptorBufferFunctions* functions{nullptr};
+
+        //A set already written into a region, keyed like DescriptorSetCache.
+        struct WrittenSet {
+            Descriptors::DescriptorSetCache::Key key;
+            VkDeviceSize offset{0};
+            VkDeviceSize end{0};
+        };
+
+        //Each frame in flight owns one region of regionSize bytes.
+        VkDeviceSize regionSize{0};
+        VkDeviceSize head{0};
+        VkDeviceSize regionEnd{0};
+        std::vector<std::vector<WrittenSet>> regions;
+        uint32_t region{0};
+        size_t nextSet{0};
+        uint64_t hits{0};
+        uint64_t misses{0};
+
+        bool create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const DescriptorBufferFunctions& loadedFunctions,
+            uint32_t framesInFlight, VkDeviceSize bytesPerFrame = 64 * 1024);
+
+        //The frame's fence must have signalled, everything it wrote last time round is overwritten.
+        void beginFrame(uint32_t frameIndex);
+
+        //Writes every descriptor of a set with this layout, unless the region already holds it at this position.
+        //Empty when the frame's region is full.
+        std::optional<DescriptorBufferBinding> write(VkDevice logicalDevice, VkDescriptorSetLayout layout, const Descriptors::DescriptorWriter& writes);
+
+        //Forgets what every region holds, the next frames write all their descriptors again.
+        void clear();
+
+        void destroy(VkDevice logicalDevice);
+    };
+
+}
+
+namespace Vulkan {
+    bool supportsDescriptorBuffers(VkPhysicalDevice physicalDevice) {
+        if (!checkDeviceExtensionSupport(physicalDevice, descriptorBufferExtensions)) {
+            return false;
+        }
+
+        VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBuffer{};
+        descriptorBuffer.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{};
+        synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+        synchronization2.pNext = &descriptorBuffer;
+        VkPhysicalDeviceBufferDeviceAddressFeaturesKHR bufferDeviceAddress{};
+        bufferDeviceAddress.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+        bufferDeviceAddress.pNext = &synchronization2;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &bufferDeviceAddress;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        return descriptorBuffer.descriptorBuffer == VK_TRUE &&
+            synchronization2.synchronization2 == VK_TRUE &&
+            bufferDeviceAddress.bufferDeviceAddress == VK_TRUE;
+    }
+
+    bool DescriptorBufferFunctions::load(VkDevice logicalDevice) {
+        auto loadFunction = [&](auto& function, const char* name) {
+            function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(vkGetDeviceProcAddr(logicalDevice, name));
+            if (function == nullptr) {
+                Logging::failure("Couldn't load {}.", name);
+            }
+            return function != nullptr;
+        };
+
+        return loadFunction(getLayoutSize, "vkGetDescriptorSetLayoutSizeEXT") &&
+            loadFunction(getBindingOffset, "vkGetDescriptorSetLayoutBindingOffsetEXT") &&
+            loadFunction(getDescriptor, "vkGetDescriptorEXT") &&
+            loadFunction(bindDescriptorBuffers, "vkCmdBindDescriptorBuffersEXT") &&
+            loadFunction(setDescriptorBufferOffsets, "vkCmdSetDescriptorBufferOffsetsEXT") &&
+            loadFunction(getBufferDeviceAddress, "vkGetBufferDeviceAddressKHR");
+    }
+
+    void DescriptorBufferBinding::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t set) const {
+        VkDescriptorBufferBindingInfoEXT bindingInfo{};
+        bindingInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+        bindingInfo.address = address;
+        bindingInfo.usage = usage;
+        functions->bindDescriptorBuffers(commandBuffer, 1, &bindingInfo);
+
+        uint32_t bufferIndex = 0;
+        functions->setDescriptorBufferOffsets(commandBuffer, bindPoint, pipelineLayout, set, 1, &bufferIndex, &offset);
+    }
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return alignment == 0 ? value : (value + alignment - 1) / alignment * alignment;
+    }
+
+    bool DescriptorBuffer::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const DescriptorBufferFunctions& loadedFunctions,
+        uint32_t framesInFlight, VkDeviceSize bytesPerFrame) {
+        functions = &loadedFunctions;
+
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 deviceProperties{};
+        deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        deviceProperties.pNext = &properties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties);
+
+        regionSize = alignUp(bytesPerFrame, properties.descriptorBufferOffsetAlignment);
+        std::tie(buffer, memory) = createBuffer(physicalDevice, logicalDevice, regionSize * framesInFlight, usage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR);
+        if (buffer == VK_NULL_HANDLE || memory == VK_NULL_HANDLE) {
+            Logging::failure("Couldn't create the descriptor buffer.");
+            destroy(logicalDevice);
+            return false;
+        }
+
+        void* data = nullptr;
+        if (vkMapMemory(logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+            Logging::failure("Couldn't map the descriptor buffer.");
+            destroy(logicalDevice);
+            return false;
+        }
+        mapped = static_cast<std::byte*>(data);
+
+        VkBufferDeviceAddressInfoKHR addressInfo{};
+        addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+        addressInfo.buffer = buffer;
+        address = functions->getBufferDeviceAddress(logicalDevice, &addressInfo);
+
+        regions.assign(framesInFlight, {});
+        beginFrame(0);
+        Logging::info("Descriptor buffer with {} KiB per frame.", regionSize / 1024);
+        return true;
+    }
+
+    void DescriptorBuffer::beginFrame(uint32_t frameIndex) {
+        head = regionSize * frameIndex;
+        regionEnd = head + regionSize;
+        region = frameIndex;
+        nextSet = 0;
+    }
+
+    void DescriptorBuffer::clear() {
+        for (auto& written : regions) {
+            written.clear();
+        }
+    }
+
+    size_t descriptorSize(const VkPhysicalDeviceDescriptorBufferPropertiesEXT& properties, VkDescriptorType type) {
+        switch (type) {
+            case VK_DESCRIPTOR_TYPE_SAMPLER: return properties.samplerDescriptorSize;
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: return properties.combinedImageSamplerDescriptorSize;
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE: return properties.sampledImageDescriptorSize;
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE: return properties.storageImageDescriptorSize;
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: return properties.uniformBufferDescriptorSize;
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: return properties.storageBufferDescriptorSize;
+            default: return 0;
+        }
+    }
+
+    std::optional<DescriptorBufferBinding> DescriptorBuffer::write(
+        VkDevice logicalDevice, VkDescriptorSetLayout layout, const Descriptors::DescriptorWriter& writes) {
+        auto& written = regions[region];
+        auto key = Descriptors::DescriptorSetCache::key(layout, writes);
+        if (nextSet < written.size() && written[nextSet].key == key) {
+            hits++;
+            head = written[nextSet].end;
+            return DescriptorBufferBinding{functions, address, usage, written[nextSet++].offset};
+        }
+        misses++;
+        //Everything from this position on was written for a different sequence of sets.
+        written.resize(nextSet);
+
+        VkDeviceSize layoutSize = 0;
+        functions->getLayoutSize(logicalDevice, layout, &layoutSize);
+        VkDeviceSize setOffset = alignUp(head, properties.descriptorBufferOffsetAlignment);
+        if (setOffset + layoutSize > regionEnd) {
+            Logging::failure("The frame's descriptor buffer region is full.");
+            return {};
+        }
+
+        for (const auto& write : writes.writes) {
+            size_t size = descriptorSize(properties, write.descriptorType);
+            if (size == 0) {
+                Logging::failure("Descriptor type {} isn't supported in descriptor buffers.", static_cast<int>(write.descriptorType));
+                return {};
+            }
+
+            VkDeviceSize bindingOffset = 0;
+            functions->getBindingOffset(logicalDevice, layout, write.dstBinding, &bindingOffset);
+
+            VkDescriptorGetInfoEXT getInfo{};
+            getInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+            getInfo.type = write.descriptorType;
+
+            VkDescriptorAddressInfoEXT addressInfo{};
+            if (write.pBufferInfo != nullptr) {
+                if (write.pBufferInfo->range == VK_WHOLE_SIZE) {
+                    Logging::failure("Descriptor buffers need an explicit range for binding {}.", write.dstBinding);
+                    return {};
+                }
+                VkBufferDeviceAddressInfoKHR bufferAddressInfo{};
+                bufferAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+                bufferAddressInfo.buffer = write.pBufferInfo->buffer;
+
+                addressInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT;
+                addressInfo.address = functions->getBufferDeviceAddress(logicalDevice, &bufferAddressInfo) + write.pBufferInfo->offset;
+                addressInfo.range = write.pBufferInfo->range;
+                addressInfo.format = VK_FORMAT_UNDEFINED;
+                if (write.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+                    getInfo.data.pUniformBuffer = &addressInfo;
+                } else {
+                    getInfo.data.pStorageBuffer = &addressInfo;
+                }
+            } else if (write.pImageInfo != nullptr) {
+                switch (write.descriptorType) {
+                    case VK_DESCRIPTOR_TYPE_SAMPLER: getInfo.data.pSampler = &write.pImageInfo->sampler; break;
+                    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: getInfo.data.pCombinedImageSampler = write.pImageInfo; break;
+                    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE: getInfo.data.pSampledImage = write.pImageInfo; break;
+                    default: getInfo.data.pStorageImage = write.pImageInfo; break;
+                }
+            }
+
+            auto* destination = mapped + setOffset + bindingOffset + write.dstArrayElement * size;
+            functions->getDescriptor(logicalDevice, &getInfo, size, destination);
+        }
+
+        head = setOffset + layoutSize;
+        written.push_back({std::move(key), setOffset, head});
+        nextSet++;
+        return DescriptorBufferBinding{functions, address, usage, setOffset};
+    }
+
+    void DescriptorBuffer::destroy(VkDevice logicalDevice) {
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+        }
+        if (memory != VK_NULL_HANDLE) {
+            vkFreeMemory(logicalDevice, memory, nullptr);
+            memory = VK_NULL_HANDLE;
+        }
+        mapped = nullptr;
+        regions.clear();
+    }
+}
@@ -0,0 +1,152 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module DescriptorCache;
+
+import std;
+import Descriptors;
+import PipelineState;
+
+/*
+    Descriptor sets looked up by what they hold. A request is the set layout plus a DescriptorWriter describing
+    every binding; the first time a combination is seen a set is allocated and written, after that the same
+    VkDescriptorSet comes straight back with no allocation and no vkUpdateDescriptorSets.
+
+    Sets not requested for a while are evicted by frame age. Pools here aren't created with FREE_DESCRIPTOR_SET,
+    so an evicted set goes on a free list for its layout and is rewritten by the next miss using that layout.
+    Entries hold raw handles, so sets referencing a destroyed buffer or image have to be dropped with clear().
+*/
+
+export namespace Descriptors {
+
+    struct DescriptorSetCache {
+        struct Key {
+            std::vector<uint64_t> words;
+            bool operator==(const Key&) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                Vulkan::StateHasher hasher;
+                hasher.bytes(key.words.data(), key.words.size() * sizeof(uint64_t));
+                return static_cast<size_t>(hasher.value);
+            }
+        };
+
+        struct Entry {
+            VkDescriptorSet set{VK_NULL_HANDLE};
+            VkDescriptorSetLayout layout{VK_NULL_HANDLE};
+            uint64_t lastUsedFrame{0};
+        };
+
+        DescriptorAllocator allocator;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>> freeSets;
+        uint64_t hits{0};
+        uint64_t misses{0};
+
+        //Every word a set's contents depend on, the layout and each write's binding and resource.
+        static Key key(VkDescriptorSetLayout layout, const DescriptorWriter& writes);
+
+        void create(VkDevice logicalDevice, uint32_t initialSets = 64, std::span<const PoolSizeRatio> poolRatios = defaultPoolRatios);
+
+        VkDescriptorSet get(VkDevice logicalDevice, VkDescriptorSetLayout layout, DescriptorWriter writes, uint64_t frameNumber);
+
+        //Sets unused for maxAge frames go back on the free list. Never sooner than framesInFlight, the GPU may still read them.
+        void evict(uint64_t frameNumber, uint32_t framesInFlight, uint32_t maxAge = 120);
+
+        //Forgets every entry, IE after the device is idle and resources they reference were destroyed. The sets are kept for reuse.
+        void clear();
+
+        void destroy(VkDevice logicalDevice);
+    };
+
+}
+
+namespace Descriptors {
+    template <typename Handle>
+    uint64_t handleBits(Handle handle) {
+        if constexpr (std::is_pointer_v<Handle>) {
+            return static_cast<uint64_t>(reinterpret_cast<std::uintptr_t>(handle));
+        } else {
+            return static_cast<uint64_t>(handle);
+        }
+    }
+
+    DescriptorSetCache::Key DescriptorSetCache::key(VkDescriptorSetLayout layout, const DescriptorWriter& writes) {
+        Key setKey;
+        setKey.words.reserve(1 + writes.writes.size() * 6);
+        setKey.words.push_back(handleBits(layout));
+        for (const auto& write : writes.writes) {
+            setKey.words.push_back(write.dstBinding);
+            setKey.words.push_back(write.dstArrayElement);
+            setKey.words.push_back(static_cast<uint64_t>(write.descriptorType));
+            if (write.pBufferInfo != nullptr) {
+                setKey.words.push_back(handleBits(write.pBufferInfo->buffer));
+                setKey.words.push_back(write.pBufferInfo->offset);
+                setKey.words.push_back(write.pBufferInfo->range);
+            } else if (write.pImageInfo != nullptr) {
+                setKey.words.push_back(handleBits(write.pImageInfo->imageView));
+                setKey.words.push_back(static_cast<uint64_t>(write.pImageInfo->imageLayout));
+                setKey.words.push_back(handleBits(write.pImageInfo->sampler));
+            }
+        }
+        return setKey;
+    }
+
+    void DescriptorSetCache::create(VkDevice logicalDevice, uint32_t initialSets, std::span<const PoolSizeRatio> poolRatios) {
+        allocator.create(logicalDevice, initialSets, poolRatios);
+    }
+
+    VkDescriptorSet DescriptorSetCache::get(VkDevice logicalDevice, VkDescriptorSetLayout layout, DescriptorWriter writes, uint64_t frameNumber) {
+        auto setKey = key(layout, writes);
+        if (auto found = entries.find(setKey); found != entries.end()) {
+            found->second.lastUsedFrame = frameNumber;
+            hits++;
+            return found->second.set;
+        }
+        misses++;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        auto& reusable = freeSets[layout];
+        if (!reusable.empty()) {
+            set = reusable.back();
+            reusable.pop_back();
+        } else {
+            set = allocator.allocate(logicalDevice, layout);
+            if (set == VK_NULL_HANDLE) {
+                return VK_NULL_HANDLE;
+            }
+        }
+
+        writes.apply(logicalDevice, set);
+        entries.emplace(std::move(setKey), Entry{set, layout, frameNumber});
+        return set;
+    }
+
+    void DescriptorSetCache::evict(uint64_t frameNumber, uint32_t framesInFlight, uint32_t maxAge) {
+        uint64_t age = std::max(maxAge, framesInFlight);
+        std::erase_if(entries, [&](const auto& item) {
+            const auto& entry = item.second;
+            if (entry.lastUsedFrame + age > frameNumber) {
+                return false;
+            }
+            freeSets[entry.layout].push_back(entry.set);
+            return true;
+        });
+    }
+
+    void DescriptorSetCache::clear() {
+        for (const auto& [key, entry] : entries) {
+            freeSets[entry.layout].push_back(entry.set);
+        }
+        entries.clear();
+    }
+
+    void DescriptorSetCache::destroy(VkDevice logicalDevice) {
+        entries.clear();
+        freeSets.clear();
+        allocator.destroy(logicalDevice);
+    }
+}
@@ -0,0 +1,231 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module DescriptorTemplates;
+
+import std;
+import Logging;
+import PhysicalDevice;
+
+/*
+    Descriptor update templates generated from a set layout's bindings. The template reads a packed C++ struct
+    holding each binding's descriptor infos back to back in binding order, so updating every binding of a set is
+    one call instead of a VkWriteDescriptorSet per binding:
+
+        struct MaterialBindings {
+            VkDescriptorBufferInfo parameters;   //binding 0, uniform buffer
+            VkDescriptorImageInfo albedo;        //binding 1, combined image sampler
+        };
+
+    Buffer bindings take a VkDescriptorBufferInfo, image and sampler bindings a VkDescriptorImageInfo and texel
+    buffers a VkBufferView, one per array element. The same struct feeds a normal set through update() or, with
+    VK_KHR_push_descriptor, is pushed straight into the command buffer with no set at all through push(). The
+    frame's uniform set is pushed that way whenever the device has the extension, see PushDescriptorBinding.
+*/
+
+export namespace Vulkan {
+
+    const std::vector<const char*> pushDescriptorExtensions = {
+        VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME
+    };
+
+    bool supportsPushDescriptors(VkPhysicalDevice physicalDevice);
+
+    //Extension entry points, not exported by the 1.1 loader.
+    struct PushDescriptorFunctions {
+        PFN_vkCmdPushDescriptorSetKHR pushDescriptorSet{nullptr};
+        PFN_vkCmdPushDescriptorSetWithTemplateKHR pushDescriptorSetWithTemplate{nullptr};
+
+        bool load(VkDevice logicalDevice);
+    };
+
+    struct DescriptorTemplate {
+        VkDescriptorUpdateTemplate handle{VK_NULL_HANDLE};
+        //Size of the packed struct the entries expect.
+        size_t dataSize{0};
+        //Push templates only, where the pushed set goes.
+        VkPipelineLayout pipelineLayout{VK_NULL_HANDLE};
+        uint32_t set{0};
+
+        bool valid() const {
+            return handle != VK_NULL_HANDLE;
+        }
+
+        template <typename Bindings>
+            requires std::is_standard_layout_v<Bindings>
+        void update(VkDevice logicalDevice, VkDescriptorSet descriptorSet, const Bindings& bindings) const {
+            if (sizeof(Bindings) != dataSize) {
+                Logging::failure("Descriptor bindings are {} bytes, the template expects {}.", sizeof(Bindings), dataSize);
+                return;
+            }
+            vkUpdateDescriptorSetWithTemplate(logicalDevice, descriptorSet, handle, &bindings);
+        }
+
+        template <typename Bindings>
+            requires std::is_standard_layout_v<Bindings>
+        void push(const PushDescriptorFunctions& functions, VkCommandBuffer commandBuffer, const Bindings& bindings) const {
+            if (sizeof(Bindings) != dataSize) {
+                Logging::failure("Descriptor bindings are {} bytes, the template expects {}.", sizeof(Bindings), dataSize);
+                return;
+            }
+            functions.pushDescriptorSetWithTemplate(commandBuffer, handle, pipelineLayout, set, &bindings);
+        }
+
+        void destroy(VkDevice logicalDevice) {
+            if (handle != VK_NULL_HANDLE) {
+                vkDestroyDescriptorUpdateTemplate(logicalDevice, handle, nullptr);
+                handle = VK_NULL_HANDLE;
+            }
+        }
+    };
+
+    //One set's bindings captured for recordCommandBuffer to push, the counterpart of DescriptorBufferBinding.
+    struct PushDescriptorBinding {
+        const PushDescriptorFunctions* functions{nullptr};
+        const DescriptorTemplate* descriptorTemplate{nullptr};
+        //The packed struct the template reads, copied so the binding doesn't point at a temporary.
+        std::vector<std::byte> data;
+
+        template <typename Bindings>
+            requires std::is_standard_layout_v<Bindings>
+        static std::optional<PushDescriptorBinding> of(const PushDescriptorFunctions& functions, const DescriptorTemplate& descriptorTemplate, const Bindings& bindings) {
+            if (sizeof(Bindings) != descriptorTemplate.dataSize) {
+                Logging::failure("Descriptor bindings are {} bytes, the template expects {}.", sizeof(Bindings), descriptorTemplate.dataSize);
+                return {};
+            }
+            auto bytes = std::as_bytes(std::span{&bindings, 1});
+            return PushDescriptorBinding{&functions, &descriptorTemplate, {bytes.begin(), bytes.end()}};
+        }
+
+        void push(VkCommandBuffer commandBuffer) const {
+            functions->pushDescriptorSetWithTemplate(commandBuffer, descriptorTemplate->handle,
+                descriptorTemplate->pipelineLayout, descriptorTemplate->set, data.data());
+        }
+    };
+
+    //For sets allocated from a pool, written with DescriptorTemplate::update.
+    DescriptorTemplate createDescriptorTemplate(
+        VkDevice logicalDevice,
+        std::span<const VkDescriptorSetLayoutBinding> bindings,
+        VkDescriptorSetLayout setLayout
+    );
+
+    //For a set whose layout was created with PUSH_DESCRIPTOR, see ShaderReflectionCache::usePushDescriptors.
+    DescriptorTemplate createPushDescriptorTemplate(
+        VkDevice logicalDevice,
+        std::span<const VkDescriptorSetLayoutBinding> bindings,
+        VkPipelineBindPoint bindPoint,
+        VkPipelineLayout pipelineLayout,
+        uint32_t set
+    );
+
+}
+
+namespace Vulkan {
+    bool supportsPushDescriptors(VkPhysicalDevice physicalDevice) {
+        return checkDeviceExtensionSupport(physicalDevice, pushDescriptorExtensions);
+    }
+
+    bool PushDescriptorFunctions::load(VkDevice logicalDevice) {
+        pushDescriptorSet = reinterpret_cast<PFN_vkCmdPushDescriptorSetKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkCmdPushDescriptorSetKHR"));
+        pushDescriptorSetWithTemplate = reinterpret_cast<PFN_vkCmdPushDescriptorSetWithTemplateKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkCmdPushDescriptorSetWithTemplateKHR"));
+        if (pushDescriptorSet == nullptr || pushDescriptorSetWithTemplate == nullptr) {
+            Logging::failure("Couldn't load the push descriptor functions.");
+            return false;
+        }
+        return true;
+    }
+
+    //What one array element of a binding occupies in the packed struct, 0 for types templates can't express this way.
+    size_t descriptorInfoSize(VkDescriptorType type) {
+        switch (type) {
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+                return sizeof(VkDescriptorBufferInfo);
+            case VK_DESCRIPTOR_TYPE_SAMPLER:
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+            case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+                return sizeof(VkDescriptorImageInfo);
+            case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+            case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+                return sizeof(VkBufferView);
+            default:
+                return 0;
+        }
+    }
+
+    std::optional<std::vector<VkDescriptorUpdateTemplateEntry>> packedEntries(
+        std::span<const VkDescriptorSetLayoutBinding> bindings, size_t& dataSize) {
+        std::vector<VkDescriptorSetLayoutBinding> sorted(bindings.begin(), bindings.end());
+        std::ranges::sort(sorted, {}, &VkDescriptorSetLayoutBinding::binding);
+
+        std::vector<VkDescriptorUpdateTemplateEntry> entries;
+        dataSize = 0;
+        for (const auto& binding : sorted) {
+            size_t infoSize = descriptorInfoSize(binding.descriptorType);
+            if (infoSize == 0 || binding.descriptorCount == 0) {
+                Logging::failure("Binding {} can't be written through a descriptor template.", binding.binding);
+                return {};
+            }
+
+            VkDescriptorUpdateTemplateEntry entry{};
+            entry.dstBinding = binding.binding;
+            entry.dstArrayElement = 0;
+            entry.descriptorCount = binding.descriptorCount;
+            entry.descriptorType = binding.descriptorType;
+            entry.offset = dataSize;
+            entry.stride = infoSize;
+            entries.push_back(entry);
+            dataSize += infoSize * binding.descriptorCount;
+        }
+        return entries;
+    }
+
+    DescriptorTemplate createTemplate(
+        VkDevice logicalDevice, std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorUpdateTemplateCreateInfo createInfo) {
+        DescriptorTemplate descriptorTemplate;
+        auto entries = packedEntries(bindings, descriptorTemplate.dataSize);
+        if (!entries) {
+            return descriptorTemplate;
+        }
+
+        createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+        createInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries->size());
+        createInfo.pDescriptorUpdateEntries = entries->data();
+        if (vkCreateDescriptorUpdateTemplate(logicalDevice, &createInfo, nullptr, &descriptorTemplate.handle) != VK_SUCCESS) {
+            Logging::failure("Couldn't create a descriptor update template.");
+            descriptorTemplate.handle = VK_NULL_HANDLE;
+        }
+        return descriptorTemplate;
+    }
+
+    DescriptorTemplate createDescriptorTemplate(
+        VkDevice logicalDevice, std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorSetLayout setLayout) {
+        VkDescriptorUpdateTemplateCreateInfo createInfo{};
+        createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+        createInfo.descriptorSetLayout = setLayout;
+        return createTemplate(logicalDevice, bindings, createInfo);
+    }
+
+    DescriptorTemplate createPushDescriptorTemplate(
+        VkDevice logicalDevice, std::span<const VkDescriptorSetLayoutBinding> bindings,
+        VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t set) {
+        VkDescriptorUpdateTemplateCreateInfo createInfo{};
+        createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+        createInfo.pipelineBindPoint = bindPoint;
+        createInfo.pipelineLayout = pipelineLayout;
+        createInfo.set = set;
+
+        auto descriptorTemplate = createTemplate(logicalDevice, bindings, createInfo);
+        descriptorTemplate.pipelineLayout = pipelineLayout;
+        descriptorTemplate.set = set;
+        return descriptorTemplate;
+    }
+}
@@ -6,6 +6,7 @@ module;
 export module Descriptors;
 
 import std;
+import Logging;
 
 /*
     <https://vulkan-tutorial.com/en/Vertex_buffers/Vertex_input_description>
@@ -34,6 +35,12 @@ export namespace DescriptorFormat {
     constexpr auto Float = VK_FORMAT_R32_SFLOAT;
     constexpr auto Int = VK_FORMAT_R32_SINT;
     constexpr auto Uint = VK_FORMAT_R32_UINT;
+    //Packed formats, read as floats by the shader. See VertexEncoding for the CPU side encoders.
+    constexpr auto H2 = VK_FORMAT_R16G16_SFLOAT;
+    constexpr auto H4 = VK_FORMAT_R16G16B16A16_SFLOAT;
+    constexpr auto Snorm16x2 = VK_FORMAT_R16G16_SNORM;
+    constexpr auto Unorm16x2 = VK_FORMAT_R16G16_UNORM;
+    constexpr auto Unorm8x4 = VK_FORMAT_R8G8B8A8_UNORM;
 }
 
 export namespace Descriptors {
@@ -54,22 +61,151 @@ export namespace Descriptors {
         }
     };
 
-    VkDescriptorPool createDescriptorPool(VkDevice logicalDevice, uint32_t maxNumDescriptors) {
-        VkDescriptorPool descriptorPool;
-        VkDescriptorPoolSize poolSize{};
-        poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSize.descriptorCount = maxNumDescriptors;
+    //How many descriptors of a type each pool holds per set it can allocate.
+    struct PoolSizeRatio {
+        VkDescriptorType type;
+        float ratio;
+    };
 
-        VkDescriptorPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = 1;
-        poolInfo.pPoolSizes = &poolSize;
-        poolInfo.maxSets = maxNumDescriptors;
+    constexpr std::array<PoolSizeRatio, 4> defaultPoolRatios = {{
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f}
+    }};
 
-        vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool);
+    /*
+        Hands out descriptor sets from a list of pools, making a bigger pool whenever the current one runs out
+        rather than sizing one pool for everything up front. Sets are never freed one at a time, reset releases
+        every set in every pool at once, so an allocator per frame in flight makes transient sets close to free.
+    */
+    struct DescriptorAllocator {
+        static constexpr uint32_t maxSetsPerPool = 4096;
 
-        return descriptorPool;
-    }
+        std::vector<PoolSizeRatio> ratios;
+        std::vector<VkDescriptorPool> readyPools;
+        std::vector<VkDescriptorPool> fullPools;
+        uint32_t setsPerPool{0};
+
+        void create(VkDevice logicalDevice, uint32_t initialSets, std::span<const PoolSizeRatio> poolRatios = defaultPoolRatios) {
+            ratios.assign(poolRatios.begin(), poolRatios.end());
+            setsPerPool = std::max(initialSets, 1u);
+            auto pool = takePool(logicalDevice);
+            if (pool != VK_NULL_HANDLE) {
+                readyPools.push_back(pool);
+            }
+        }
+
+        VkDescriptorSet allocate(VkDevice logicalDevice, VkDescriptorSetLayout layout, const void* next = nullptr) {
+            VkDescriptorPool pool = takePool(logicalDevice);
+            if (pool == VK_NULL_HANDLE) {
+                return VK_NULL_HANDLE;
+            }
+
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = next;
+            allocInfo.descriptorPool = pool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &layout;
+
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            VkResult result = vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet);
+            if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+                //Retire the pool until the next reset and try once more with a fresh, larger one.
+                fullPools.push_back(pool);
+                pool = takePool(logicalDevice);
+                if (pool == VK_NULL_HANDLE) {
+                    return VK_NULL_HANDLE;
+                }
+                allocInfo.descriptorPool = pool;
+                result = vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet);
+            }
+            readyPools.push_back(pool);
+
+            if (result != VK_SUCCESS) {
+                Logging::failure("Failed to allocate a descriptor set.");
+                return VK_NULL_HANDLE;
+            }
+            return descriptorSet;
+        }
+
+        //Only once the GPU is done with every set allocated since the last reset.
+        void reset(VkDevice logicalDevice) {
+            for (auto pool : readyPools) {
+                vkResetDescriptorPool(logicalDevice, pool, 0);
+            }
+            for (auto pool : fullPools) {
+                vkResetDescriptorPool(logicalDevice, pool, 0);
+                readyPools.push_back(pool);
+            }
+            fullPools.clear();
+        }
+
+        void destroy(VkDevice logicalDevice) {
+            for (auto pool : readyPools) {
+                vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+            }
+            for (auto pool : fullPools) {
+                vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+            }
+            readyPools.clear();
+            fullPools.clear();
+        }
+
+    private:
+        VkDescriptorPool takePool(VkDevice logicalDevice) {
+            if (!readyPools.empty()) {
+                auto pool = readyPools.back();
+                readyPools.pop_back();
+                return pool;
+            }
+
+            std::vector<VkDescriptorPoolSize> poolSizes;
+            for (auto [type, ratio] : ratios) {
+                poolSizes.push_back({type, std::max(static_cast<uint32_t>(ratio * setsPerPool), 1u)});
+            }
+
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+            poolInfo.pPoolSizes = poolSizes.data();
+            poolInfo.maxSets = setsPerPool;
+
+            VkDescriptorPool pool = VK_NULL_HANDLE;
+            if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                Logging::failure("Failed to create a descriptor pool for {} sets.", setsPerPool);
+                return VK_NULL_HANDLE;
+            }
+            setsPerPool = std::min(setsPerPool * 2, maxSetsPerPool);
+            return pool;
+        }
+    };
+
+    //One allocator per frame in flight, reset wholesale when that frame comes round again.
+    struct FrameDescriptors {
+        std::vector<DescriptorAllocator> frames;
+
+        void create(VkDevice logicalDevice, uint32_t framesInFlight, uint32_t initialSets, std::span<const PoolSizeRatio> poolRatios = defaultPoolRatios) {
+            frames.resize(framesInFlight);
+            for (auto& frame : frames) {
+                frame.create(logicalDevice, initialSets, poolRatios);
+            }
+        }
+
+        //The frame's previous submission must have finished, IE its in flight fence has been waited on.
+        DescriptorAllocator& beginFrame(VkDevice logicalDevice, uint32_t frameIndex) {
+            frames[frameIndex].reset(logicalDevice);
+            return frames[frameIndex];
+        }
+
+        void destroy(VkDevice logicalDevice) {
+            for (auto& frame : frames) {
+                frame.destroy(logicalDevice);
+            }
+            frames.clear();
+        }
+    };
 
     VkDescriptorSetLayout createPipelineDescriptorLayout(VkDevice logicalDevice) {
         VkDescriptorSetLayout descriptorSetLayout;
@@ -84,47 +220,214 @@ export namespace Descriptors {
         return descriptorSetLayout;
     }
 
-    std::vector<VkDescriptorSet> createDescriptorSets(VkDevice logicalDevice, 
-        VkDescriptorSetLayout descriptorSetLayout, VkDescriptorPool descriptorPool, uint32_t numSets) {
-        std::vector<VkDescriptorSet> descriptorSets(numSets);
-        std::vector<VkDescriptorSetLayout> layouts(numSets, descriptorSetLayout);
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = numSets;
-        allocInfo.pSetLayouts = layouts.data();
-        vkAllocateDescriptorSets(logicalDevice, &allocInfo, descriptorSets.data());
-        return descriptorSets;
+    //Batches descriptor writes for one set, IE the storage buffers and images a compute shader reads and writes.
+    struct DescriptorWriter {
+        std::deque<VkDescriptorBufferInfo> bufferInfos;
+        std::deque<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkWriteDescriptorSet> writes;
+
+        //Writes point into the deques, moving keeps the deque blocks (and so the pointers) but copying wouldn't.
+        DescriptorWriter() = default;
+        DescriptorWriter(DescriptorWriter&&) = default;
+        DescriptorWriter& operator=(DescriptorWriter&&) = default;
+        DescriptorWriter(const DescriptorWriter&) = delete;
+        DescriptorWriter& operator=(const DescriptorWriter&) = delete;
+
+        DescriptorWriter& buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+            //Deque so earlier writes keep pointing at their infos as more are added.
+            auto& info = bufferInfos.emplace_back(buffer, offset, range);
+            auto& write = writes.emplace_back();
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstBinding = binding;
+            write.descriptorType = type;
+            write.descriptorCount = 1;
+            write.pBufferInfo = &info;
+            return *this;
+        }
+
+        DescriptorWriter& image(uint32_t binding, VkDescriptorType type, VkImageView view, VkImageLayout layout, VkSampler sampler = VK_NULL_HANDLE) {
+            auto& info = imageInfos.emplace_back(sampler, view, layout);
+            auto& write = writes.emplace_back();
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstBinding = binding;
+            write.descriptorType = type;
+            write.descriptorCount = 1;
+            write.pImageInfo = &info;
+            return *this;
+        }
+
+        DescriptorWriter& uniformBuffer(uint32_t binding, VkBuffer buffer, VkDeviceSize range = VK_WHOLE_SIZE, VkDeviceSize offset = 0) {
+            return this->buffer(binding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, buffer, offset, range);
+        }
+
+        DescriptorWriter& storageBuffer(uint32_t binding, VkBuffer buffer, VkDeviceSize range = VK_WHOLE_SIZE, VkDeviceSize offset = 0) {
+            return this->buffer(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer, offset, range);
+        }
+
+        //Storage images have to be in GENERAL layout while a shader accesses them.
+        DescriptorWriter& storageImage(uint32_t binding, VkImageView view) {
+            return image(binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, view, VK_IMAGE_LAYOUT_GENERAL);
+        }
+
+        DescriptorWriter& sampledImage(uint32_t binding, VkImageView view, VkSampler sampler) {
+            return image(binding, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, sampler);
+        }
+
+        void apply(VkDevice logicalDevice, VkDescriptorSet descriptorSet) {
+            for (auto& write : writes) {
+                write.dstSet = descriptorSet;
+            }
+            vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+    };
+
+    //The format a vertex member is read as, specialize it to give a new member type an attribute format.
+    template <typename M>
+    struct VertexFormat {
+        static constexpr VkFormat value = VK_FORMAT_UNDEFINED;
+    };
+
+    template <> struct VertexFormat<float> { static constexpr VkFormat value = DescriptorFormat::Float; };
+    template <> struct VertexFormat<glm::vec2> { static constexpr VkFormat value = DescriptorFormat::V2; };
+    template <> struct VertexFormat<glm::vec3> { static constexpr VkFormat value = DescriptorFormat::V3; };
+    template <> struct VertexFormat<glm::vec4> { static constexpr VkFormat value = DescriptorFormat::V4; };
+    template <> struct VertexFormat<std::int32_t> { static constexpr VkFormat value = DescriptorFormat::Int; };
+    template <> struct VertexFormat<glm::ivec2> { static constexpr VkFormat value = DescriptorFormat::IV2; };
+    template <> struct VertexFormat<glm::ivec3> { static constexpr VkFormat value = DescriptorFormat::IV3; };
+    template <> struct VertexFormat<glm::ivec4> { static constexpr VkFormat value = DescriptorFormat::IV4; };
+    template <> struct VertexFormat<std::uint32_t> { static constexpr VkFormat value = DescriptorFormat::Uint; };
+    template <> struct VertexFormat<glm::uvec2> { static constexpr VkFormat value = DescriptorFormat::UV2; };
+    template <> struct VertexFormat<glm::uvec3> { static constexpr VkFormat value = DescriptorFormat::UV3; };
+    template <> struct VertexFormat<glm::uvec4> { static constexpr VkFormat value = DescriptorFormat::UV4; };
+
+    //Packed member types. They only hold encoded bits, fill them with the VertexEncoding functions.
+    struct Half2 {
+        std::array<std::uint16_t, 2> bits;
+    };
+
+    //IE positions, w is padding (or 1) that keeps the attribute 8 bytes.
+    struct Half4 {
+        std::array<std::uint16_t, 4> bits;
+    };
+
+    //A unit vector folded onto an octahedron and stored as two SNORM16, decoded in the shader.
+    struct OctahedralNormal {
+        std::array<std::int16_t, 2> bits;
+    };
+
+    //IE texture coordinates in [0, 1].
+    struct Unorm16x2 {
+        std::array<std::uint16_t, 2> bits;
+    };
+
+    //IE colors.
+    struct Unorm8x4 {
+        std::array<std::uint8_t, 4> bits;
+    };
+
+    template <> struct VertexFormat<Half2> { static constexpr VkFormat value = DescriptorFormat::H2; };
+    template <> struct VertexFormat<Half4> { static constexpr VkFormat value = DescriptorFormat::H4; };
+    template <> struct VertexFormat<OctahedralNormal> { static constexpr VkFormat value = DescriptorFormat::Snorm16x2; };
+    template <> struct VertexFormat<Unorm16x2> { static constexpr VkFormat value = DescriptorFormat::Unorm16x2; };
+    template <> struct VertexFormat<Unorm8x4> { static constexpr VkFormat value = DescriptorFormat::Unorm8x4; };
+
+    template <typename P>
+    struct VertexMemberTraits;
+
+    template <typename T, typename M>
+    struct VertexMemberTraits<M T::*> {
+        using Owner = T;
+        using Type = M;
+    };
+
+    //A struct listing its vertex members, member i becoming location i, IE:
+    //  struct Vertex {
+    //      glm::vec2 pos;
+    //      glm::vec3 color;
+    //      static constexpr auto vertexMembers = std::tuple{&Vertex::pos, &Vertex::color};
+    //  };
+    template <typename V>
+    concept VertexStruct = requires { std::tuple_size<std::remove_cvref_t<decltype(V::vertexMembers)>>::value; };
+
+    template <VertexStruct V>
+    constexpr VkVertexInputBindingDescription vertexBinding(uint32_t binding = 0, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX) {
+        return {binding, sizeof(V), inputRate};
+    }
+
+    //Where the member really is in V, what offsetof gives for the member's name. Member pointers can't be turned into
+    //offsets in a constant expression, so this is measured on a value initialized V.
+    template <typename V, typename M>
+    uint32_t vertexMemberOffset(M V::* member) {
+        V probe{};
+        return static_cast<uint32_t>(reinterpret_cast<const std::byte*>(&(probe.*member)) - reinterpret_cast<const std::byte*>(&probe));
+    }
+
+    //Locations and formats are checked at compile time, offsets come from the member pointers themselves, so the
+    //members can be listed in any order and padding or unlisted members are skipped correctly.
+    template <VertexStruct V>
+    auto vertexAttributes(uint32_t binding = 0, uint32_t firstLocation = 0) {
+        static_assert(std::is_standard_layout_v<V>, "Vertex structs have to be standard layout.");
+
+        return std::apply([&](auto... members) {
+            std::array<VkVertexInputAttributeDescription, sizeof...(members)> attributes{};
+            uint32_t index = 0;
+            auto add = [&](auto member) {
+                using Traits = VertexMemberTraits<decltype(member)>;
+                using M = typename Traits::Type;
+                static_assert(std::is_same_v<typename Traits::Owner, V>, "vertexMembers names a member of another struct.");
+                static_assert(VertexFormat<M>::value != VK_FORMAT_UNDEFINED, "No VertexFormat for this member type.");
+                attributes[index] = {firstLocation + index, binding, VertexFormat<M>::value, vertexMemberOffset(member)};
+                index++;
+            };
+            (add(members), ...);
+            return attributes;
+        }, V::vertexMembers);
     }
 
     struct Vertex {
         glm::vec2 pos;
         glm::vec3 color;
 
-        static constexpr VkVertexInputBindingDescription bindingDescription() {
-            VkVertexInputBindingDescription bindingDescription{};
+        static constexpr auto vertexMembers = std::tuple{&Vertex::pos, &Vertex::color};
+    };
 
-            bindingDescription.binding = 0;
-            bindingDescription.stride = sizeof(Vertex);
-            bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    //A mesh vertex at 20 bytes, where the same data as floats (vec3 position and normal, vec4 color, vec2 uv) is 48.
+    struct PackedVertex {
+        Half4 position;
+        OctahedralNormal normal;
+        Unorm8x4 color;
+        Unorm16x2 uv;
 
-            return bindingDescription;
-        }
+        static constexpr auto vertexMembers = std::tuple{&PackedVertex::position, &PackedVertex::normal, &PackedVertex::color, &PackedVertex::uv};
+    };
 
-        static constexpr std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions() {
-            std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+    //Vertex split into two streams, positions at binding 0 and everything else at binding 1. Depth, shadow and
+    //culling passes bind only the position stream, see StagedBuffer::bind and VertexLayout::streams.
+    struct VertexPosition {
+        glm::vec2 pos;
 
-            attributeDescriptions[0].binding = 0;
-            attributeDescriptions[0].location = 0;
-            attributeDescriptions[0].format = DescriptorFormat::V2;
-            attributeDescriptions[0].offset = offsetof(Vertex, pos);
+        static constexpr auto vertexMembers = std::tuple{&VertexPosition::pos};
+    };
 
-            attributeDescriptions[1].binding = 0;
-            attributeDescriptions[1].location = 1;
-            attributeDescriptions[1].format = DescriptorFormat::V3;
-            attributeDescriptions[1].offset = offsetof(Vertex, color);
+    struct VertexAttributes {
+        glm::vec3 color;
 
-            return attributeDescriptions;
-        }
+        static constexpr auto vertexMembers = std::tuple{&VertexAttributes::color};
     };
+
+    struct VertexStreams {
+        std::vector<VertexPosition> positions;
+        std::vector<VertexAttributes> attributes;
+    };
+
+    inline VertexStreams splitVertices(std::span<const Vertex> vertices) {
+        VertexStreams streams;
+        streams.positions.reserve(vertices.size());
+        streams.attributes.reserve(vertices.size());
+        for (const auto& vertex : vertices) {
+            streams.positions.push_back({vertex.pos});
+            streams.attributes.push_back({vertex.color});
+        }
+        return streams;
+    }
 }
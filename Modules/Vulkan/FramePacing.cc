@@ -0,0 +1,270 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module FramePacing;
+
+import std;
+import Logging;
+import Queues;
+import PhysicalDevice;
+
+/*
+    Frame pacing for input-to-photon latency rather than peak throughput.
+
+    In low latency mode the CPU never runs more than one frame ahead of the display. Each frame is given a
+    deadline one frame period after the previous frame reached the screen (measured with VK_KHR_present_wait
+    when the device has it, otherwise self-clocked from the previous deadline), and the frame start is delayed
+    until just before that deadline minus the predicted CPU + GPU cost of the frame. Input is sampled after
+    that wait, so it is as fresh as it can be while the frame still makes its deadline.
+*/
+
+export namespace Vulkan {
+
+    enum class PacingMode {
+        Uncapped,   //No limiter, the swapchain present mode alone decides how far ahead the CPU runs.
+        Capped,     //Hybrid sleep/spin limiter at the target frame rate.
+        LowLatency  //Capped, but each frame starts as late as possible while still making its deadline.
+    };
+
+    struct FramePacingConfig {
+        PacingMode mode = PacingMode::LowLatency;
+        double targetFps = 60.0;
+        //The OS sleep is only trusted up to this far from a deadline, the remainder is spun.
+        std::chrono::microseconds spinThreshold{2000};
+        //Slack added on top of the predicted frame cost in low latency mode.
+        std::chrono::microseconds safetyMargin{1000};
+    };
+
+    const std::vector<const char*> presentWaitExtensions = {
+        VK_KHR_PRESENT_ID_EXTENSION_NAME,
+        VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+    };
+
+    //Feature structs to chain into device creation when present wait is supported.
+    struct PresentWaitFeatures {
+        VkPhysicalDevicePresentIdFeaturesKHR presentId{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR, nullptr, VK_TRUE};
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWait{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR, nullptr, VK_TRUE};
+
+        void* link(void* next) {
+            presentWait.pNext = next;
+            presentId.pNext = &presentWait;
+            return &presentId;
+        }
+    };
+
+    bool supportsPresentWait(VkPhysicalDevice physicalDevice);
+    void preciseSleepUntil(std::chrono::steady_clock::time_point deadline, std::chrono::microseconds spinThreshold);
+
+    struct FramePacer {
+        using Clock = std::chrono::steady_clock;
+        using Seconds = std::chrono::duration<double>;
+
+        FramePacingConfig config;
+
+        bool presentWaitEnabled{false};
+        PFN_vkWaitForPresentKHR waitForPresent{nullptr};
+        uint64_t presentIdCounter{0};
+        uint64_t lastPresentId{0};
+        VkSwapchainKHR lastPresentedSwapChain{VK_NULL_HANDLE};
+
+        //Two timestamps (top and bottom of pipe) per frame in flight.
+        VkQueryPool timestampQueries{VK_NULL_HANDLE};
+        double timestampPeriod{0.0};
+        uint64_t timestampMask{0};
+        std::vector<bool> timestampsPending;
+
+        Clock::time_point frameStart;
+        Clock::time_point nextDeadline;
+        Seconds cpuFrameTime{0.0};
+        Seconds gpuFrameTime{0.0};
+        //Unsmoothed GPU time of the most recently collected frame, zero until a new one is collected. Read it with
+        //takeGpuFrameTime so frames without a fresh timestamp don't repeat the previous one.
+        Seconds lastGpuFrameTime{0.0};
+
+        void create(
+            VkPhysicalDevice physicalDevice,
+            VkDevice logicalDevice,
+            uint32_t framesInFlight,
+            FramePacingConfig pacingConfig,
+            bool usePresentWait
+        ) {
+            config = pacingConfig;
+            nextDeadline = Clock::now();
+            timestampsPending.assign(framesInFlight, false);
+
+            if (usePresentWait) {
+                waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(logicalDevice, "vkWaitForPresentKHR"));
+                presentWaitEnabled = waitForPresent != nullptr;
+            }
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            timestampPeriod = properties.limits.timestampPeriod;
+
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+            uint32_t validBits = queueFamilies[findQueueFamilies(physicalDevice).graphicsFamily.value()].timestampValidBits;
+            if (validBits == 0) {
+                Logging::warning("Graphics queue has no timestamp support, frame pacing will only use CPU timings.");
+                return;
+            }
+            timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = framesInFlight * 2;
+
+            if (vkCreateQueryPool(logicalDevice, &queryPoolInfo, nullptr, &timestampQueries) != VK_SUCCESS) {
+                Logging::warning("Failed to create a timestamp query pool, frame pacing will only use CPU timings.");
+                timestampQueries = VK_NULL_HANDLE;
+            }
+        }
+
+        void destroy(VkDevice logicalDevice) {
+            if (timestampQueries != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(logicalDevice, timestampQueries, nullptr);
+                timestampQueries = VK_NULL_HANDLE;
+            }
+        }
+
+        void setTargetFps(double fps) {
+            config.targetFps = std::max(fps, 1.0);
+        }
+
+        Clock::duration framePeriod() const {
+            return std::chrono::duration_cast<Clock::duration>(Seconds{1.0 / config.targetFps});
+        }
+
+        uint32_t timestampQueryIndex(uint32_t frameIndex) const {
+            return frameIndex * 2;
+        }
+
+        uint64_t nextPresentId() {
+            return ++presentIdCounter;
+        }
+
+        //Blocks until the next frame should start sampling input. Call before polling events.
+        void waitForFrameStart(VkDevice logicalDevice, VkSwapchainKHR swapChain, VkFence previousFrameFence) {
+            auto period = framePeriod();
+
+            if (config.mode == PacingMode::Uncapped) {
+                frameStart = Clock::now();
+                return;
+            }
+
+            if (config.mode == PacingMode::Capped) {
+                //Fell more than a frame behind, resync rather than bursting to catch up.
+                if (nextDeadline + period < Clock::now()) {
+                    nextDeadline = Clock::now();
+                }
+                preciseSleepUntil(nextDeadline, config.spinThreshold);
+                frameStart = Clock::now();
+                nextDeadline += period;
+                return;
+            }
+
+            bool anchoredToPresent = false;
+            if (presentWaitEnabled && lastPresentId != 0 && lastPresentedSwapChain == swapChain) {
+                //A few periods of timeout so a stalled compositor degrades to the fallback instead of hanging.
+                auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(period * 4).count();
+                if (waitForPresent(logicalDevice, swapChain, lastPresentId, static_cast<uint64_t>(timeout)) == VK_SUCCESS) {
+                    nextDeadline = Clock::now() + period;
+                    anchoredToPresent = true;
+                }
+            }
+
+            if (!anchoredToPresent) {
+                //Without present timing the previous frame's fence is the only way to stop the CPU running ahead.
+                vkWaitForFences(logicalDevice, 1, &previousFrameFence, VK_TRUE, UINT64_MAX);
+                nextDeadline += period;
+            }
+
+            auto predictedCost = std::chrono::duration_cast<Clock::duration>(cpuFrameTime + gpuFrameTime) + config.safetyMargin;
+            auto now = Clock::now();
+            if (nextDeadline < now) {
+                nextDeadline = now + predictedCost;
+            }
+
+            preciseSleepUntil(nextDeadline - predictedCost, config.spinThreshold);
+            frameStart = Clock::now();
+        }
+
+        //Called once the frame's fence has signaled, picks up the GPU time written by that frame.
+        void collectGpuTime(VkDevice logicalDevice, uint32_t frameIndex) {
+            if (timestampQueries == VK_NULL_HANDLE || !timestampsPending[frameIndex]) {
+                return;
+            }
+
+            uint64_t timestamps[2];
+            VkResult result = vkGetQueryPoolResults(
+                logicalDevice, timestampQueries, timestampQueryIndex(frameIndex), 2,
+                sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+            if (result != VK_SUCCESS) {
+                return;
+            }
+            timestampsPending[frameIndex] = false;
+
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+            lastGpuFrameTime = Seconds{static_cast<double>(ticks) * timestampPeriod * 1e-9};
+            gpuFrameTime = smooth(gpuFrameTime, lastGpuFrameTime);
+        }
+
+        //For benchmark statistics. Returns the GPU time collected since the last call, or zero if there is none.
+        Seconds takeGpuFrameTime() {
+            return std::exchange(lastGpuFrameTime, Seconds{0.0});
+        }
+
+        void frameSubmitted(uint32_t frameIndex) {
+            if (timestampQueries != VK_NULL_HANDLE) {
+                timestampsPending[frameIndex] = true;
+            }
+        }
+
+        void framePresented(VkSwapchainKHR swapChain, uint64_t presentId) {
+            lastPresentedSwapChain = swapChain;
+            lastPresentId = presentId;
+            cpuFrameTime = smooth(cpuFrameTime, Clock::now() - frameStart);
+        }
+
+    private:
+        static Seconds smooth(Seconds average, Seconds sample) {
+            if (average.count() == 0.0) {
+                return sample;
+            }
+            return average * 0.9 + sample * 0.1;
+        }
+    };
+
+}
+
+namespace Vulkan {
+    bool supportsPresentWait(VkPhysicalDevice physicalDevice) {
+        if (!checkDeviceExtensionSupport(physicalDevice, presentWaitExtensions)) {
+            return false;
+        }
+
+        PresentWaitFeatures supported;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = supported.link(nullptr);
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        return supported.presentId.presentId == VK_TRUE && supported.presentWait.presentWait == VK_TRUE;
+    }
+
+    void preciseSleepUntil(std::chrono::steady_clock::time_point deadline, std::chrono::microseconds spinThreshold) {
+        //OS sleeps routinely overshoot by a scheduler tick, so sleep coarsely and spin out the remainder.
+        auto coarseDeadline = deadline - spinThreshold;
+        if (std::chrono::steady_clock::now() < coarseDeadline) {
+            std::this_thread::sleep_until(coarseDeadline);
+        }
+        while (std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+}
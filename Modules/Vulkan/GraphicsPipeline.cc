@@ -6,64 +6,74 @@ export module GraphicsPipeline;
 
 import std;
 import Logging;
-import Descriptors;
+import PipelineCache;
+import PipelineState;
+import ShaderCode;
 
 export namespace Vulkan {
 
-    std::tuple<VkPipelineLayout, VkPipeline> createGraphicsPipeline(
-        VkDevice logicalDevice, 
-        VkRenderPass renderPass,
-        VkDescriptorSetLayout descriptorSetLayout
+    VkPipelineLayout createPipelineLayout(VkDevice logicalDevice, VkDescriptorSetLayout descriptorSetLayout);
+
+    //Thread safe, the shared VkPipelineCache is internally synchronized.
+    //Shaders come from the binary when embedded, preferDiskShaders reads Shaders/ instead for hot reload.
+    VkPipeline createGraphicsPipeline(
+        VkDevice logicalDevice,
+        const PipelineState& state,
+        const PipelineCache& pipelineCache,
+        bool preferDiskShaders = false,
+        VkPipelineCreateFlags flags = 0
     );
 
 }
 
 namespace Vulkan {
-    std::optional<std::vector<char>> readFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-        if (!file.is_open()) {
-            return {};
-        }
-
-        size_t fileSize = (size_t) file.tellg();
-        std::vector<char> buffer(fileSize);
-
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-        file.close();
-
-        return buffer;
-    }
-
-    VkShaderModule createShaderModule(auto logicalDevice, const std::vector<char>& code) {
+    VkShaderModule createShaderModule(auto logicalDevice, std::span<const std::uint32_t> code) {
         VkShaderModule shaderModule;
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+        createInfo.codeSize = code.size_bytes();
+        createInfo.pCode = code.data();
         vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule);
         return shaderModule;
     }
 
-    std::tuple<VkPipelineLayout, VkPipeline> createGraphicsPipeline(VkDevice logicalDevice, VkRenderPass renderPass, VkDescriptorSetLayout descriptorSetLayout) {
-        VkPipelineLayout pipelineLayout;
-        VkPipeline graphicsPipeline;
+    VkPipelineLayout createPipelineLayout(VkDevice logicalDevice, VkDescriptorSetLayout descriptorSetLayout) {
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.pushConstantRangeCount = 0;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+        vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+
+        if(pipelineLayout == VK_NULL_HANDLE) {
+            Logging::failure("Couldn't make pipeline layout");
+        }
+        return pipelineLayout;
+    }
 
-        auto vertShaderCode = readFile("Shaders/vert.spv");
-        auto fragShaderCode = readFile("Shaders/frag.spv");
+    VkPipeline createGraphicsPipeline(
+        VkDevice logicalDevice, const PipelineState& state, const PipelineCache& pipelineCache, bool preferDiskShaders, VkPipelineCreateFlags flags) {
+        VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+
+        auto vertShaderCode = Shaders::loadSpirv(state.vertexShader, preferDiskShaders);
+        auto fragShaderCode = Shaders::loadSpirv(state.fragmentShader, preferDiskShaders);
 
         if (!vertShaderCode.has_value() || !fragShaderCode.has_value()) {
-            Logging::failure("Couldn't find or use shader files.");
-            return std::make_tuple(VK_NULL_HANDLE, VK_NULL_HANDLE);
+            Logging::failure("Couldn't find or use shader files for pipeline {}.", state.name);
+            return VK_NULL_HANDLE;
         }
 
-        VkShaderModule vertShaderModule = createShaderModule(logicalDevice, vertShaderCode.value());
-        VkShaderModule fragShaderModule = createShaderModule(logicalDevice, fragShaderCode.value());
+        VkShaderModule vertShaderModule = createShaderModule(logicalDevice, vertShaderCode->words);
+        VkShaderModule fragShaderModule = createShaderModule(logicalDevice, fragShaderCode->words);
 
         if (vertShaderModule == VK_NULL_HANDLE || fragShaderModule == VK_NULL_HANDLE) {
-            Logging::failure("Couldn't initialize shaders.");
-            return std::make_tuple(VK_NULL_HANDLE, VK_NULL_HANDLE);
+            Logging::failure("Couldn't initialize shaders for pipeline {}.", state.name);
+            vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+            vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
+            return VK_NULL_HANDLE;
         }
 
         VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
@@ -81,19 +91,28 @@ namespace Vulkan {
 
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-        auto bindingDescription = Descriptors::Vertex::bindingDescription();
-        auto attributeDescriptions = Descriptors::Vertex::attributeDescriptions();
+        //Constant values are baked in by the driver, so branches on them compile out of this variant.
+        VkSpecializationInfo specializationInfo = state.constants.info();
+        if (!state.constants.empty()) {
+            for (auto& stage : shaderStages) {
+                if (state.constants.stages & stage.stage) {
+                    stage.pSpecializationInfo = &specializationInfo;
+                }
+            }
+        }
+
+        const auto& vertexLayout = state.vertexLayout;
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
-        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexLayout.bindings.size());
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexLayout.attributes.size());
+        vertexInputInfo.pVertexBindingDescriptions = vertexLayout.bindings.data();
+        vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data();
 
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
         inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.topology = state.raster.topology;
         inputAssembly.primitiveRestartEnable = VK_FALSE;
 
         VkPipelineViewportStateCreateInfo viewportState{};
@@ -105,27 +124,43 @@ namespace Vulkan {
         rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
         rasterizer.depthClampEnable = VK_FALSE;
         rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.polygonMode = state.raster.polygonMode;
         rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.cullMode = state.raster.cullMode;
+        rasterizer.frontFace = state.raster.frontFace;
         rasterizer.depthBiasEnable = VK_FALSE;
 
         VkPipelineMultisampleStateCreateInfo multisampling{};
         multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
         multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.rasterizationSamples = state.raster.samples;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = state.depth.testEnable ? VK_TRUE : VK_FALSE;
+        depthStencil.depthWriteEnable = state.depth.writeEnable ? VK_TRUE : VK_FALSE;
+        depthStencil.depthCompareOp = state.depth.compareOp;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
 
         VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+        colorBlendAttachment.colorWriteMask = state.blend.writeMask;
+        colorBlendAttachment.blendEnable = state.blend.enable ? VK_TRUE : VK_FALSE;
+        colorBlendAttachment.srcColorBlendFactor = state.blend.srcColor;
+        colorBlendAttachment.dstColorBlendFactor = state.blend.dstColor;
+        colorBlendAttachment.colorBlendOp = state.blend.colorOp;
+        colorBlendAttachment.srcAlphaBlendFactor = state.blend.srcAlpha;
+        colorBlendAttachment.dstAlphaBlendFactor = state.blend.dstAlpha;
+        colorBlendAttachment.alphaBlendOp = state.blend.alphaOp;
+        //Every color target shares the one blend state.
+        std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(std::max<size_t>(state.targets.color.size(), 1), colorBlendAttachment);
 
         VkPipelineColorBlendStateCreateInfo colorBlending{};
         colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
         colorBlending.logicOpEnable = VK_FALSE;
         colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.attachmentCount = static_cast<uint32_t>(colorBlendAttachments.size());
+        colorBlending.pAttachments = colorBlendAttachments.data();
         colorBlending.blendConstants[0] = 0.0f;
         colorBlending.blendConstants[1] = 0.0f;
         colorBlending.blendConstants[2] = 0.0f;
@@ -137,21 +172,9 @@ namespace Vulkan {
         dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
         dynamicState.pDynamicStates = dynamicStates.data();
 
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.pushConstantRangeCount = 0;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-
-        vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout);
-
-        if(pipelineLayout == VK_NULL_HANDLE) {
-            Logging::failure("Couldn't make pipeline layout");
-            return std::make_tuple(VK_NULL_HANDLE, VK_NULL_HANDLE);
-        }
-
         VkGraphicsPipelineCreateInfo pipelineInfo{};
         pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.flags = flags;
         pipelineInfo.stageCount = 2;
         pipelineInfo.pStages = shaderStages;
         pipelineInfo.pVertexInputState = &vertexInputInfo;
@@ -159,18 +182,32 @@ namespace Vulkan {
         pipelineInfo.pViewportState = &viewportState;
         pipelineInfo.pRasterizationState = &rasterizer;
         pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = state.targets.depth != VK_FORMAT_UNDEFINED ? &depthStencil : nullptr;
         pipelineInfo.pColorBlendState = &colorBlending;
         pipelineInfo.pDynamicState = &dynamicState;
-        pipelineInfo.layout = pipelineLayout;
-        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.layout = state.layout;
+        pipelineInfo.renderPass = state.renderPass;
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline);
+        PipelineCreationFeedback feedback;
+        if (pipelineCache.creationFeedbackEnabled) {
+            pipelineInfo.pNext = feedback.link(pipelineInfo.pNext, pipelineInfo.stageCount);
+        }
+
+        auto compileStart = std::chrono::steady_clock::now();
+        vkCreateGraphicsPipelines(logicalDevice, pipelineCache.vulkanCache, 1, &pipelineInfo, nullptr, &graphicsPipeline);
+        std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
+
+        if (pipelineCache.creationFeedbackEnabled) {
+            feedback.log(state.name);
+        } else {
+            Logging::info("Pipeline {}: {:.3f} ms.", state.name, compileTime.count());
+        }
 
         vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
         vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
 
-        return std::make_tuple(pipelineLayout, graphicsPipeline);
+        return graphicsPipeline;
     }
 }
\ No newline at end of file
@@ -11,13 +11,17 @@ export namespace Vulkan {
 
     std::tuple<VkDevice, VkQueue> createLogicalDevice(
         VkPhysicalDevice physicalDevice, 
-        const std::vector<const char*> requiredDeviceExtensions
+        const std::vector<const char*> requiredDeviceExtensions,
+        const void* featureChain = nullptr,
+        //Core 1.0 features, IE textureCompressionBC.
+        const VkPhysicalDeviceFeatures& enabledFeatures = {}
     );
 
 }
 
 namespace Vulkan {
-    std::tuple<VkDevice, VkQueue> createLogicalDevice(VkPhysicalDevice physicalDevice, const std::vector<const char*> requiredDeviceExtensions) {
+    std::tuple<VkDevice, VkQueue> createLogicalDevice(VkPhysicalDevice physicalDevice, const std::vector<const char*> requiredDeviceExtensions, const void* featureChain,
+        const VkPhysicalDeviceFeatures& enabledFeatures) {
         VkDevice logicalDevice;
         VkQueue graphicsQueue;
 
@@ -30,9 +34,11 @@ namespace Vulkan {
         float queuePriority = 1.0f;
         queueCreateInfo.pQueuePriorities = &queuePriority;
 
-        VkPhysicalDeviceFeatures deviceFeatures{};
+        VkPhysicalDeviceFeatures deviceFeatures = enabledFeatures;
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        //Optional extension feature structs, IE VkPhysicalDevicePresentWaitFeaturesKHR.
+        createInfo.pNext = featureChain;
         createInfo.pQueueCreateInfos = &queueCreateInfo;
         createInfo.queueCreateInfoCount = 1;
         createInfo.pEnabledFeatures = &deviceFeatures;
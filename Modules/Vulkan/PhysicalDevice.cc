@@ -10,10 +10,11 @@ import SwapChain;
 
 export namespace Vulkan {
     VkPhysicalDevice pickPhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::vector<const char*> requiredDeviceExtensions);
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& requiredDeviceExtensions);
 }
 
 namespace Vulkan {
-    bool checkDeviceExtensionSupport(auto device, auto requiredDeviceExtensions) {
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& requiredDeviceExtensions) {
         uint32_t extensionCount;
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
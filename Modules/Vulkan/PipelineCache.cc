@@ -0,0 +1,164 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module PipelineCache;
+
+import std;
+import Logging;
+
+export namespace Vulkan {
+
+    const std::vector<const char*> pipelineCreationFeedbackExtensions = {
+        VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME
+    };
+
+    //Driver pipeline cache persisted between runs, so shaders are only compiled by the driver once per driver version.
+    struct PipelineCache {
+        VkPipelineCache vulkanCache{VK_NULL_HANDLE};
+        std::filesystem::path path;
+        bool creationFeedbackEnabled{false};
+
+        //Seeds the cache from disk when the file was written by this exact device and driver, otherwise starts empty.
+        bool load(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::filesystem::path& cachePath, bool creationFeedback);
+        //Writes to a temporary file then renames over the old one, so a crash mid save never leaves a torn cache.
+        bool save(VkDevice logicalDevice) const;
+        void destroy(VkDevice logicalDevice);
+    };
+
+    //VK_EXT_pipeline_creation_feedback for a single pipeline, chain it into the create info then log it after creation.
+    struct PipelineCreationFeedback {
+        static constexpr uint32_t maxStages = 8;
+
+        VkPipelineCreationFeedbackEXT pipeline{};
+        std::array<VkPipelineCreationFeedbackEXT, maxStages> stages{};
+        VkPipelineCreationFeedbackCreateInfoEXT createInfo{};
+
+        const void* link(const void* next, uint32_t stageCount) {
+            createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+            createInfo.pNext = next;
+            createInfo.pPipelineCreationFeedback = &pipeline;
+            createInfo.pipelineStageCreationFeedbackCount = std::min(stageCount, maxStages);
+            createInfo.pPipelineStageCreationFeedbacks = stages.data();
+            return &createInfo;
+        }
+
+        void log(std::string_view pipelineName) const;
+    };
+
+}
+
+namespace Vulkan {
+    bool PipelineCache::load(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::filesystem::path& cachePath, bool creationFeedback) {
+        path = cachePath;
+        creationFeedbackEnabled = creationFeedback;
+
+        std::vector<char> data;
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (file.is_open()) {
+            data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(data.data(), data.size());
+            file.close();
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        //The driver is allowed to reject foreign data, but some crash on it instead, so check the header ourselves.
+        bool valid = false;
+        if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+            VkPipelineCacheHeaderVersionOne header;
+            std::memcpy(&header, data.data(), sizeof(header));
+            valid = header.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+                header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                header.vendorID == properties.vendorID &&
+                header.deviceID == properties.deviceID &&
+                std::ranges::equal(header.pipelineCacheUUID, properties.pipelineCacheUUID);
+        }
+
+        if (!data.empty() && !valid) {
+            Logging::warning("Pipeline cache {} was written by a different device or driver, starting empty.", path.string());
+        }
+
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = valid ? data.size() : 0;
+        createInfo.pInitialData = valid ? data.data() : nullptr;
+
+        if (vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &vulkanCache) != VK_SUCCESS) {
+            Logging::failure("Failed to create a pipeline cache.");
+            vulkanCache = VK_NULL_HANDLE;
+            return false;
+        }
+
+        if (valid) {
+            Logging::info("Loaded {} bytes of pipeline cache from {}.", data.size(), path.string());
+        }
+        return true;
+    }
+
+    bool PipelineCache::save(VkDevice logicalDevice) const {
+        if (vulkanCache == VK_NULL_HANDLE) {
+            return false;
+        }
+
+        size_t size = 0;
+        vkGetPipelineCacheData(logicalDevice, vulkanCache, &size, nullptr);
+        std::vector<char> data(size);
+        if (size == 0 || vkGetPipelineCacheData(logicalDevice, vulkanCache, &size, data.data()) != VK_SUCCESS) {
+            Logging::warning("Pipeline cache had no data to save.");
+            return false;
+        }
+
+        auto temporaryPath = path;
+        temporaryPath += ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                Logging::failure("Couldn't open {} to save the pipeline cache.", temporaryPath.string());
+                return false;
+            }
+            file.write(data.data(), static_cast<std::streamsize>(size));
+            if (!file.good()) {
+                Logging::failure("Failed writing the pipeline cache to {}.", temporaryPath.string());
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error) {
+            Logging::failure("Couldn't replace {}: {}", path.string(), error.message());
+            return false;
+        }
+
+        Logging::info("Saved {} bytes of pipeline cache to {}.", size, path.string());
+        return true;
+    }
+
+    void PipelineCache::destroy(VkDevice logicalDevice) {
+        if (vulkanCache != VK_NULL_HANDLE) {
+            vkDestroyPipelineCache(logicalDevice, vulkanCache, nullptr);
+            vulkanCache = VK_NULL_HANDLE;
+        }
+    }
+
+    void PipelineCreationFeedback::log(std::string_view pipelineName) const {
+        if (!(pipeline.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+            return;
+        }
+
+        bool cacheHit = pipeline.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT;
+        Logging::info("Pipeline {}: {:.3f} ms, cache {}.", pipelineName, pipeline.duration / 1e6, cacheHit ? "hit" : "miss");
+
+        for (uint32_t i = 0; i < createInfo.pipelineStageCreationFeedbackCount; i++) {
+            const auto& stage = stages[i];
+            if (!(stage.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+                continue;
+            }
+            bool stageHit = stage.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT;
+            Logging::info("Pipeline {} stage {}: {:.3f} ms, cache {}.", pipelineName, i, stage.duration / 1e6, stageHit ? "hit" : "miss");
+        }
+    }
+}
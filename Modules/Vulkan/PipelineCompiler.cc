@@ -0,0 +1,273 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module PipelineCompiler;
+
+import std;
+import Logging;
+import GraphicsPipeline;
+import PipelineCache;
+import PipelineState;
+
+/*
+    Builds graphics pipelines on a pool of worker threads.
+
+    submit() only queues the pipeline state and returns a handle, so it never blocks. All workers compile through
+    the one shared VkPipelineCache, which Vulkan synchronizes internally. The render loop polls get() each frame
+    and skips draws whose pipeline is still compiling.
+*/
+
+export namespace Vulkan {
+
+    enum class PipelineStatus { Pending, Ready, Failed };
+
+    struct CompiledPipeline {
+        PipelineState state;
+        std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+        std::atomic<PipelineStatus> status{PipelineStatus::Pending};
+        //A rebuilt pipeline waiting for swapReloaded, see reload. Guarded by the compiler mutex.
+        VkPipeline reloaded{VK_NULL_HANDLE};
+        bool reloadQueued{false};
+    };
+
+    struct CompileJob {
+        CompiledPipeline* compiled;
+        bool reload;
+    };
+
+    struct RetiredPipeline {
+        VkPipeline pipeline;
+        uint64_t retiredAtFrame;
+    };
+
+    //Points at the compiler's stable storage, so polling it needs no lock.
+    struct PipelineHandle {
+        const CompiledPipeline* compiled{nullptr};
+
+        bool valid() const {
+            return compiled != nullptr;
+        }
+    };
+
+    struct PipelineCompiler {
+        VkDevice logicalDevice;
+        const PipelineCache* pipelineCache;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable jobsChanged;
+        std::deque<CompileJob> jobs;
+        uint32_t jobsInProgress{0};
+        bool stopping{false};
+
+        //Deque so pipelines never move while workers and handles point at them. Guarded by mutex.
+        std::deque<CompiledPipeline> pipelines;
+        std::vector<CompiledPipeline*> reloadsReady;
+        std::vector<RetiredPipeline> retired;
+        //Set for hot reload, so pipelines are built from the SPIR-V on disk rather than the copy embedded at build time.
+        bool preferDiskShaders{false};
+        //Applied to every pipeline, IE DESCRIPTOR_BUFFER when sets live in a descriptor buffer.
+        VkPipelineCreateFlags pipelineFlags{0};
+
+        //0 workers picks one less than the hardware thread count, leaving a core for the render loop.
+        void start(VkDevice device, const PipelineCache& cache, uint32_t workerCount = 0);
+        void stop();
+        //Stops the workers and destroys every pipeline. The device must be idle.
+        void destroy();
+        //Joins the compile workers but keeps every pipeline, destroying them needs an idle device, see destroy().
+        ~PipelineCompiler();
+
+        //Thread safe.
+        PipelineHandle submit(PipelineState state);
+
+        //Never blocks. VK_NULL_HANDLE until the pipeline is ready.
+        VkPipeline get(PipelineHandle handle) const;
+        PipelineStatus status(PipelineHandle handle) const;
+
+        //Blocks until every submitted pipeline has finished compiling, IE at the end of a loading screen.
+        void waitIdle();
+
+        //Rebuilds every ready pipeline that uses this SPIR-V file in the background. The old pipeline keeps being
+        //used until swapReloaded. Returns how many pipelines were queued.
+        uint32_t reload(const std::filesystem::path& spirvPath);
+
+        //Call once per frame on the render thread, before recording. Swaps in finished reloads and destroys
+        //replaced pipelines once every frame that could still be using them has retired.
+        void swapReloaded(uint64_t frameNumber, uint32_t framesInFlight);
+    };
+
+}
+
+namespace Vulkan {
+    void PipelineCompiler::start(VkDevice device, const PipelineCache& cache, uint32_t workerCount) {
+        logicalDevice = device;
+        pipelineCache = &cache;
+        stopping = false;
+
+        if (workerCount == 0) {
+            workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        }
+        Logging::info("Pipeline compiler starting {} workers.", workerCount);
+
+        for (uint32_t i = 0; i < workerCount; i++) {
+            workers.emplace_back([this]() {
+                while (true) {
+                    CompileJob job;
+                    {
+                        std::unique_lock lock(mutex);
+                        jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                        if (jobs.empty()) {
+                            return;
+                        }
+                        job = jobs.front();
+                        jobs.pop_front();
+                        jobsInProgress++;
+                        //Cleared once compiling starts, so a save during the compile queues another reload.
+                        if (job.reload) {
+                            job.compiled->reloadQueued = false;
+                        }
+                    }
+
+                    VkPipeline pipeline = createGraphicsPipeline(logicalDevice, job.compiled->state, *pipelineCache, preferDiskShaders || job.reload, pipelineFlags);
+                    if (!job.reload) {
+                        job.compiled->pipeline.store(pipeline, std::memory_order_relaxed);
+                        job.compiled->status.store(pipeline != VK_NULL_HANDLE ? PipelineStatus::Ready : PipelineStatus::Failed, std::memory_order_release);
+                    } else if (pipeline == VK_NULL_HANDLE) {
+                        Logging::warning("Reloading pipeline {} failed, keeping the previous version.", job.compiled->state.name);
+                    }
+
+                    {
+                        std::lock_guard lock(mutex);
+                        jobsInProgress--;
+                        if (job.reload && pipeline != VK_NULL_HANDLE) {
+                            //An earlier reload may still be waiting for its swap, the newer one replaces it.
+                            if (job.compiled->reloaded != VK_NULL_HANDLE) {
+                                vkDestroyPipeline(logicalDevice, job.compiled->reloaded, nullptr);
+                            } else {
+                                reloadsReady.push_back(job.compiled);
+                            }
+                            job.compiled->reloaded = pipeline;
+                        }
+                    }
+                    jobsChanged.notify_all();
+                }
+            });
+        }
+    }
+
+    void PipelineCompiler::stop() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            //Queued builds turn Failed so draws stop waiting on them. Queued reloads are dropped, the pipeline they
+            //would have replaced stays in use.
+            for (auto& job : jobs) {
+                if (!job.reload) {
+                    job.compiled->status.store(PipelineStatus::Failed, std::memory_order_release);
+                }
+            }
+            jobs.clear();
+        }
+        jobsChanged.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    PipelineCompiler::~PipelineCompiler() {
+        stop();
+    }
+
+    void PipelineCompiler::destroy() {
+        stop();
+        for (auto& compiled : pipelines) {
+            VkPipeline pipeline = compiled.pipeline.load(std::memory_order_acquire);
+            if (pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+            }
+            if (compiled.reloaded != VK_NULL_HANDLE) {
+                vkDestroyPipeline(logicalDevice, compiled.reloaded, nullptr);
+            }
+        }
+        for (auto& old : retired) {
+            vkDestroyPipeline(logicalDevice, old.pipeline, nullptr);
+        }
+        pipelines.clear();
+        reloadsReady.clear();
+        retired.clear();
+    }
+
+    PipelineHandle PipelineCompiler::submit(PipelineState state) {
+        CompiledPipeline* compiled;
+        {
+            std::lock_guard lock(mutex);
+            compiled = &pipelines.emplace_back();
+            compiled->state = std::move(state);
+            jobs.push_back({compiled, false});
+        }
+        jobsChanged.notify_one();
+        return {compiled};
+    }
+
+    VkPipeline PipelineCompiler::get(PipelineHandle handle) const {
+        if (status(handle) != PipelineStatus::Ready) {
+            return VK_NULL_HANDLE;
+        }
+        return handle.compiled->pipeline.load(std::memory_order_relaxed);
+    }
+
+    PipelineStatus PipelineCompiler::status(PipelineHandle handle) const {
+        if (!handle.valid()) {
+            return PipelineStatus::Failed;
+        }
+        return handle.compiled->status.load(std::memory_order_acquire);
+    }
+
+    void PipelineCompiler::waitIdle() {
+        std::unique_lock lock(mutex);
+        jobsChanged.wait(lock, [this]() { return jobs.empty() && jobsInProgress == 0; });
+    }
+
+    uint32_t PipelineCompiler::reload(const std::filesystem::path& spirvPath) {
+        auto changed = spirvPath.lexically_normal();
+        uint32_t queued = 0;
+        {
+            std::lock_guard lock(mutex);
+            for (auto& compiled : pipelines) {
+                bool usesShader = compiled.state.vertexShader.lexically_normal() == changed ||
+                    compiled.state.fragmentShader.lexically_normal() == changed;
+                //Pending pipelines will read the new file anyway, failed ones are left to the next request.
+                if (!usesShader || compiled.reloadQueued || compiled.status.load(std::memory_order_acquire) != PipelineStatus::Ready) {
+                    continue;
+                }
+                compiled.reloadQueued = true;
+                jobs.push_back({&compiled, true});
+                queued++;
+            }
+        }
+        jobsChanged.notify_all();
+        return queued;
+    }
+
+    void PipelineCompiler::swapReloaded(uint64_t frameNumber, uint32_t framesInFlight) {
+        std::lock_guard lock(mutex);
+        for (auto* compiled : reloadsReady) {
+            VkPipeline old = compiled->pipeline.exchange(compiled->reloaded, std::memory_order_acq_rel);
+            compiled->reloaded = VK_NULL_HANDLE;
+            retired.push_back({old, frameNumber});
+            Logging::info("Swapped in reloaded pipeline {}.", compiled->state.name);
+        }
+        reloadsReady.clear();
+
+        //Frames recorded before the swap are at most framesInFlight frames old, and drawFrame has waited on their fences by now.
+        std::erase_if(retired, [&](const RetiredPipeline& old) {
+            if (frameNumber < old.retiredAtFrame + framesInFlight) {
+                return false;
+            }
+            vkDestroyPipeline(logicalDevice, old.pipeline, nullptr);
+            return true;
+        });
+    }
+}
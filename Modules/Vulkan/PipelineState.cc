@@ -0,0 +1,325 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module PipelineState;
+
+import std;
+import Descriptors;
+
+/*
+    A value description of a graphics pipeline. The defaults reproduce the original hard coded basic pipeline,
+    so a material only spells out what it changes, IE:
+        PipelineState transparent = basic;
+        transparent.blend = BlendState::alpha();
+*/
+
+export namespace Vulkan {
+
+    struct VertexLayout {
+        std::vector<VkVertexInputBindingDescription> bindings;
+        std::vector<VkVertexInputAttributeDescription> attributes;
+
+        template <Descriptors::VertexStruct V>
+        static VertexLayout of(uint32_t binding = 0) {
+            auto attributes = Descriptors::vertexAttributes<V>(binding);
+            return {{Descriptors::vertexBinding<V>(binding)}, {attributes.begin(), attributes.end()}};
+        }
+
+        //Position at binding 0, attributes at binding 1 continuing the locations after the position members.
+        template <Descriptors::VertexStruct Position, Descriptors::VertexStruct Attributes>
+        static VertexLayout streams() {
+            auto layout = of<Position>(0);
+            auto attributes = Descriptors::vertexAttributes<Attributes>(1, static_cast<uint32_t>(layout.attributes.size()));
+            layout.bindings.push_back(Descriptors::vertexBinding<Attributes>(1));
+            layout.attributes.insert(layout.attributes.end(), attributes.begin(), attributes.end());
+            return layout;
+        }
+
+        bool operator==(const VertexLayout& other) const;
+    };
+
+    struct RasterState {
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+        VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+        VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+        bool operator==(const RasterState&) const = default;
+    };
+
+    struct DepthState {
+        bool testEnable = false;
+        bool writeEnable = false;
+        VkCompareOp compareOp = VK_COMPARE_OP_LESS;
+
+        bool operator==(const DepthState&) const = default;
+    };
+
+    struct BlendState {
+        bool enable = false;
+        VkBlendFactor srcColor = VK_BLEND_FACTOR_ONE;
+        VkBlendFactor dstColor = VK_BLEND_FACTOR_ZERO;
+        VkBlendOp colorOp = VK_BLEND_OP_ADD;
+        VkBlendFactor srcAlpha = VK_BLEND_FACTOR_ONE;
+        VkBlendFactor dstAlpha = VK_BLEND_FACTOR_ZERO;
+        VkBlendOp alphaOp = VK_BLEND_OP_ADD;
+        VkColorComponentFlags writeMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        static BlendState alpha() {
+            BlendState state;
+            state.enable = true;
+            state.srcColor = VK_BLEND_FACTOR_SRC_ALPHA;
+            state.dstColor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            return state;
+        }
+
+        bool operator==(const BlendState&) const = default;
+    };
+
+    struct RenderTargetFormats {
+        std::vector<VkFormat> color;
+        VkFormat depth = VK_FORMAT_UNDEFINED;
+
+        bool operator==(const RenderTargetFormats&) const = default;
+    };
+
+    //One specialization constant, see SpecializationConstants.
+    template <typename T, typename M>
+    struct SpecializationMember {
+        using Type = M;
+        uint32_t constantId;
+        M T::* member;
+    };
+
+    template <typename T, typename M>
+    constexpr SpecializationMember<T, M> specialize(uint32_t constantId, M T::* member) {
+        return {constantId, member};
+    }
+
+    //A struct naming its constant_id members, IE:
+    //  struct LightingVariant {
+    //      uint32_t lightCount = 4;
+    //      bool textured = true;
+    //      static constexpr auto specializationConstants = std::tuple{
+    //          specialize(0, &LightingVariant::lightCount),
+    //          specialize(1, &LightingVariant::textured)
+    //      };
+    //  };
+    template <typename T>
+    concept Specializable = requires { std::tuple_size<std::remove_cvref_t<decltype(T::specializationConstants)>>::value; };
+
+    //SPIR-V booleans are 32 bit, so bool members are packed as VkBool32.
+    template <typename M>
+    using SpecializationStorage = std::conditional_t<std::is_same_v<M, bool>, VkBool32, M>;
+
+    template <typename M>
+    void packSpecialization(uint8_t* destination, const M& value) {
+        static_assert(std::is_arithmetic_v<M> && (sizeof(SpecializationStorage<M>) == 4 || sizeof(SpecializationStorage<M>) == 8),
+            "Specialization constants are 32 or 64 bit scalars.");
+        SpecializationStorage<M> stored = static_cast<SpecializationStorage<M>>(value);
+        std::memcpy(destination, &stored, sizeof(stored));
+    }
+
+    //Map entries for T, packed back to back in declaration order and built entirely at compile time.
+    template <Specializable T>
+    constexpr auto specializationMapEntries() {
+        return std::apply([](auto... members) {
+            std::array<VkSpecializationMapEntry, sizeof...(members)> entries{};
+            uint32_t offset = 0;
+            size_t index = 0;
+            auto add = [&](auto member) {
+                constexpr uint32_t size = sizeof(SpecializationStorage<typename decltype(member)::Type>);
+                entries[index++] = {member.constantId, offset, size};
+                offset += size;
+            };
+            (add(members), ...);
+            return entries;
+        }, T::specializationConstants);
+    }
+
+    //Specialization constant values for a pipeline. Different values are different pipelines, so they're part of
+    //the state hash and every combination becomes its own cached variant.
+    struct SpecializationConstants {
+        std::vector<VkSpecializationMapEntry> entries;
+        std::vector<uint8_t> data;
+        VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        template <Specializable T>
+        static SpecializationConstants of(const T& values, VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
+            static constexpr auto mapEntries = specializationMapEntries<T>();
+
+            SpecializationConstants constants;
+            constants.entries.assign(mapEntries.begin(), mapEntries.end());
+            constants.stages = stages;
+            constants.data.resize(mapEntries.empty() ? 0 : mapEntries.back().offset + mapEntries.back().size);
+
+            std::apply([&](auto... members) {
+                size_t index = 0;
+                (packSpecialization(constants.data.data() + mapEntries[index++].offset, values.*members.member), ...);
+            }, T::specializationConstants);
+            return constants;
+        }
+
+        bool empty() const {
+            return entries.empty();
+        }
+
+        //The 32 bit value given for a constant_id, if this sets it.
+        std::optional<uint32_t> value(uint32_t constantId) const {
+            for (const auto& entry : entries) {
+                if (entry.constantID == constantId && entry.size == sizeof(uint32_t) && entry.offset + entry.size <= data.size()) {
+                    uint32_t value;
+                    std::memcpy(&value, data.data() + entry.offset, sizeof(value));
+                    return value;
+                }
+            }
+            return {};
+        }
+
+        //Points into this object, keep it alive until the pipeline is created.
+        VkSpecializationInfo info() const {
+            return {static_cast<uint32_t>(entries.size()), entries.data(), data.size(), data.data()};
+        }
+
+        bool operator==(const SpecializationConstants& other) const;
+    };
+
+    struct PipelineState {
+        //Only for logs, not part of the hash.
+        std::string name;
+        std::filesystem::path vertexShader;
+        std::filesystem::path fragmentShader;
+        VertexLayout vertexLayout = VertexLayout::streams<Descriptors::VertexPosition, Descriptors::VertexAttributes>();
+        RasterState raster;
+        DepthState depth;
+        BlendState blend;
+        RenderTargetFormats targets;
+        SpecializationConstants constants;
+
+        //Runtime objects the pipeline is built against. Not part of the stable hash, see PipelineStateCache.
+        VkPipelineLayout layout{VK_NULL_HANDLE};
+        VkRenderPass renderPass{VK_NULL_HANDLE};
+
+        //FNV-1a over the state values field by field (never raw struct bytes, which include padding), so equal
+        //states hash equally in every run and on every machine.
+        uint64_t hash() const;
+
+        //Everything the pipeline is built from, the layout and render pass included. The name is ignored.
+        bool operator==(const PipelineState& other) const;
+
+        //A copy of this state with its specialization constants set, IE pipelineStates.request(basic.specialized(variant)).
+        template <Specializable T>
+        PipelineState specialized(const T& values, VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) const {
+            PipelineState variant = *this;
+            variant.constants = SpecializationConstants::of(values, stages);
+            return variant;
+        }
+    };
+
+    struct StateHasher {
+        uint64_t value = 14695981039346656037ull;
+
+        void bytes(const void* data, size_t size) {
+            auto* byte = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; i++) {
+                value = (value ^ byte[i]) * 1099511628211ull;
+            }
+        }
+
+        template <typename T>
+            requires std::is_integral_v<T> || std::is_enum_v<T>
+        void add(T field) {
+            uint64_t widened = static_cast<uint64_t>(field);
+            bytes(&widened, sizeof(widened));
+        }
+
+        void add(std::string_view text) {
+            add(text.size());
+            bytes(text.data(), text.size());
+        }
+    };
+
+}
+
+namespace Vulkan {
+    bool VertexLayout::operator==(const VertexLayout& other) const {
+        return std::ranges::equal(bindings, other.bindings, [](const auto& a, const auto& b) {
+            return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+        }) && std::ranges::equal(attributes, other.attributes, [](const auto& a, const auto& b) {
+            return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+        });
+    }
+
+    bool SpecializationConstants::operator==(const SpecializationConstants& other) const {
+        return stages == other.stages && data == other.data &&
+            std::ranges::equal(entries, other.entries, [](const auto& a, const auto& b) {
+                return a.constantID == b.constantID && a.offset == b.offset && a.size == b.size;
+            });
+    }
+
+    bool PipelineState::operator==(const PipelineState& other) const {
+        return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+            vertexLayout == other.vertexLayout && raster == other.raster && depth == other.depth &&
+            blend == other.blend && targets == other.targets && constants == other.constants &&
+            layout == other.layout && renderPass == other.renderPass;
+    }
+
+    uint64_t PipelineState::hash() const {
+        StateHasher hasher;
+        hasher.add(vertexShader.generic_string());
+        hasher.add(fragmentShader.generic_string());
+
+        hasher.add(vertexLayout.bindings.size());
+        for (const auto& binding : vertexLayout.bindings) {
+            hasher.add(binding.binding);
+            hasher.add(binding.stride);
+            hasher.add(binding.inputRate);
+        }
+        hasher.add(vertexLayout.attributes.size());
+        for (const auto& attribute : vertexLayout.attributes) {
+            hasher.add(attribute.location);
+            hasher.add(attribute.binding);
+            hasher.add(attribute.format);
+            hasher.add(attribute.offset);
+        }
+
+        hasher.add(raster.topology);
+        hasher.add(raster.polygonMode);
+        hasher.add(raster.cullMode);
+        hasher.add(raster.frontFace);
+        hasher.add(raster.samples);
+
+        hasher.add(depth.testEnable);
+        hasher.add(depth.writeEnable);
+        hasher.add(depth.compareOp);
+
+        hasher.add(blend.enable);
+        hasher.add(blend.srcColor);
+        hasher.add(blend.dstColor);
+        hasher.add(blend.colorOp);
+        hasher.add(blend.srcAlpha);
+        hasher.add(blend.dstAlpha);
+        hasher.add(blend.alphaOp);
+        hasher.add(blend.writeMask);
+
+        hasher.add(targets.color.size());
+        for (auto format : targets.color) {
+            hasher.add(format);
+        }
+        hasher.add(targets.depth);
+
+        hasher.add(constants.stages);
+        hasher.add(constants.entries.size());
+        for (const auto& entry : constants.entries) {
+            hasher.add(entry.constantID);
+            hasher.add(entry.offset);
+            hasher.add(entry.size);
+        }
+        hasher.add(constants.data.size());
+        hasher.bytes(constants.data.data(), constants.data.size());
+
+        return hasher.value;
+    }
+}
@@ -0,0 +1,78 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module PipelineStateCache;
+
+import std;
+import Logging;
+import PipelineState;
+import PipelineCompiler;
+
+/*
+    Deduplicates pipelines by state. The first request for a state submits it to the PipelineCompiler, every later
+    request for an identical state (from any thread) gets the same handle back, so materials that happen to share
+    state share one VkPipeline instead of each building their own. The hash only picks the bucket, states are
+    compared in full, so a collision costs a comparison rather than returning another state's pipeline.
+*/
+
+export namespace Vulkan {
+
+    struct PipelineStateCache {
+        PipelineCompiler* compiler{nullptr};
+
+        struct StateHash {
+            size_t operator()(const PipelineState& state) const {
+                return static_cast<size_t>(key(state));
+            }
+        };
+
+        std::shared_mutex mutex;
+        std::unordered_map<PipelineState, PipelineHandle, StateHash> variants;
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> misses{0};
+
+        void create(PipelineCompiler& pipelineCompiler) {
+            compiler = &pipelineCompiler;
+        }
+
+        //The cache key is the stable state hash mixed with the layout and render pass the pipeline is built against.
+        static uint64_t key(const PipelineState& state) {
+            StateHasher hasher{state.hash()};
+            hasher.add(reinterpret_cast<uint64_t>(state.layout));
+            hasher.add(reinterpret_cast<uint64_t>(state.renderPass));
+            return hasher.value;
+        }
+
+        //Thread safe. Submits the state for compilation the first time it is seen.
+        PipelineHandle request(const PipelineState& state) {
+            requests.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::shared_lock lock(mutex);
+                if (auto found = variants.find(state); found != variants.end()) {
+                    return found->second;
+                }
+            }
+
+            std::unique_lock lock(mutex);
+            //Another thread may have won the race between the two locks.
+            if (auto found = variants.find(state); found != variants.end()) {
+                return found->second;
+            }
+            misses.fetch_add(1, std::memory_order_relaxed);
+            auto handle = compiler->submit(state);
+            variants.emplace(state, handle);
+            return handle;
+        }
+
+        //Never blocks, VK_NULL_HANDLE until the variant has compiled.
+        VkPipeline get(const PipelineState& state) {
+            return compiler->get(request(state));
+        }
+
+        void logStatistics() const {
+            Logging::info("Pipeline state cache: {} requests, {} unique pipelines.", requests.load(), misses.load());
+        }
+    };
+
+}
@@ -9,6 +9,11 @@ import Commands;
 import SwapChain;
 import Logging;
 import Buffers;
+import FramePacing;
+import Readback;
+import ShaderObjects;
+import DescriptorBuffer;
+import DescriptorTemplates;
 
 export namespace Vulkan {
 
@@ -38,7 +43,13 @@ export namespace Vulkan {
         RenderSync synchronizers,
         const Vulkan::StagedBuffer& stagedVertexBuffer,
         Vulkan::UniformBuffer& uniformBuffer,
-        bool& framebufferResized
+        bool& framebufferResized,
+        FramePacer& framePacer,
+        uint32_t frameIndex,
+        FrameReadback* frameReadback,
+        const ShaderObjectDraw* shaderObjects = nullptr,
+        const DescriptorBufferBinding* descriptorBuffer = nullptr,
+        const PushDescriptorBinding* pushDescriptors = nullptr
     );
 
 }
@@ -77,9 +88,20 @@ namespace Vulkan {
         RenderSync synchronizers,
         const Vulkan::StagedBuffer& stagedVertexBuffer,
         Vulkan::UniformBuffer& uniformBuffer,
-        bool& framebufferResized
+        bool& framebufferResized,
+        FramePacer& framePacer,
+        uint32_t frameIndex,
+        FrameReadback* frameReadback,
+        const ShaderObjectDraw* shaderObjects,
+        const DescriptorBufferBinding* descriptorBuffer,
+        const PushDescriptorBinding* pushDescriptors
         ) {
         vkWaitForFences(logicalDevice, 1, &synchronizers.inFlightFence, VK_TRUE, UINT64_MAX);
+        framePacer.collectGpuTime(logicalDevice, frameIndex);
+        swapChain.releaseRetired(logicalDevice);
+        if (frameReadback != nullptr) {
+            frameReadback->collect(logicalDevice, frameIndex);
+        }
 
         uint32_t imageIndex;
         VkResult result = vkAcquireNextImageKHR(
@@ -105,10 +127,19 @@ namespace Vulkan {
 
         vkResetFences(logicalDevice, 1, &synchronizers.inFlightFence);
 
+        std::optional<ShaderObjectDraw> shaderObjectDraw;
+        if (shaderObjects != nullptr) {
+            shaderObjectDraw = *shaderObjects;
+            shaderObjectDraw->targetImage = swapChain.images[imageIndex];
+            shaderObjectDraw->targetView = swapChain.imageViews[imageIndex];
+        }
+
         vkResetCommandBuffer(commandBuffer, 0);
         Vulkan::recordCommandBuffer(
             commandBuffer, imageIndex, graphicsPipeline, pipelineLayout, renderPass, 
-            swapChain.framebuffers, swapChain.extent, stagedVertexBuffer, uniformBuffer);
+            swapChain.framebuffers, swapChain.extent, stagedVertexBuffer, uniformBuffer,
+            framePacer.timestampQueries, framePacer.timestampQueryIndex(frameIndex),
+            shaderObjectDraw ? &shaderObjectDraw.value() : nullptr, descriptorBuffer, pushDescriptors);
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -119,8 +150,15 @@ namespace Vulkan {
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
+        //Readback copies go in the same submission, after the frame and before the present semaphore signals.
+        VkCommandBuffer submittedCommandBuffers[] = {commandBuffer, VK_NULL_HANDLE};
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        if (frameReadback != nullptr) {
+            submittedCommandBuffers[1] = frameReadback->record(
+                logicalDevice, frameIndex, swapChain.images[imageIndex], swapChain.extent, swapChain.format);
+            submitInfo.commandBufferCount = submittedCommandBuffers[1] != VK_NULL_HANDLE ? 2 : 1;
+        }
+        submitInfo.pCommandBuffers = submittedCommandBuffers;
 
         VkSemaphore signalSemaphores[] = {synchronizers.renderFinishedSemaphore};
         submitInfo.signalSemaphoreCount = 1;
@@ -130,10 +168,22 @@ namespace Vulkan {
             Logging::failure("Failed to submit draw frame queue.");
             return false;
         }
+        framePacer.frameSubmitted(frameIndex);
+        swapChain.trackFrame(synchronizers.inFlightFence);
 
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
+        //Tag the present so the pacer can later wait for it to actually reach the display.
+        uint64_t presentId = framePacer.nextPresentId();
+        VkPresentIdKHR presentIdInfo{};
+        presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds = &presentId;
+        if (framePacer.presentWaitEnabled) {
+            presentInfo.pNext = &presentIdInfo;
+        }
+
         presentInfo.waitSemaphoreCount = 1;
         presentInfo.pWaitSemaphores = signalSemaphores;
 
@@ -143,8 +193,11 @@ namespace Vulkan {
         presentInfo.pImageIndices = &imageIndex;
 
         result = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+        if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+            framePacer.framePresented(swapChain.vulkanSwapChain, presentId);
+        }
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized || swapChain.rebuildRequested) {
             framebufferResized = false;
             Logging::info("Acquiring a new swapchain as the current one is out of date.");
             swapChain.rebuild(physicalDevice, logicalDevice, renderPass);
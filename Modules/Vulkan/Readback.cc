@@ -0,0 +1,480 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module Readback;
+
+import std;
+import Logging;
+import Buffers;
+
+/*
+    Asynchronous frame readback.
+
+    Every frame in flight owns a host cached readback buffer and a small command buffer that copies the
+    presented image into it. The copy is submitted together with the frame, so nothing ever waits on the queue.
+    When drawFrame has waited on that frame's fence (which it does anyway before reusing the frame), the buffer
+    is invalidated, copied out and handed to a background thread that encodes and writes it to disk.
+*/
+
+export namespace Vulkan {
+
+    enum class ImageFileFormat { Ppm, Png, Raw };
+
+    struct ReadbackConfig {
+        std::filesystem::path directory = "Captures";
+        ImageFileFormat format = ImageFileFormat::Png;
+        //Frames queued for the writer before the render loop is made to wait on the disk.
+        size_t maxQueuedFrames = 16;
+    };
+
+    struct CapturedFrame {
+        uint64_t frameNumber;
+        VkExtent2D extent;
+        VkFormat format;
+        std::vector<uint8_t> pixels;
+    };
+
+    //Encodes captured frames on a background thread.
+    struct ImageSequenceWriter {
+        ReadbackConfig config;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable queueChanged;
+        std::deque<CapturedFrame> queue;
+        bool stopping{false};
+
+        void start(ReadbackConfig writerConfig);
+        void push(CapturedFrame frame);
+        //Drains everything still queued, then joins the worker.
+        void stop();
+        //Same as stop(), so frames captured before an early exit are still written out.
+        ~ImageSequenceWriter();
+    };
+
+    struct FrameReadback {
+        struct Slot {
+            VkBuffer buffer{VK_NULL_HANDLE};
+            VkDeviceMemory memory{VK_NULL_HANDLE};
+            VkDeviceSize size{0};
+            void* mapped{nullptr};
+            VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+            bool pending{false};
+            uint64_t frameNumber{0};
+            VkExtent2D extent{};
+            VkFormat format{VK_FORMAT_UNDEFINED};
+        };
+
+        VkPhysicalDevice physicalDevice;
+        VkMemoryPropertyFlags memoryProperties;
+        std::vector<Slot> slots;
+        ImageSequenceWriter writer;
+        uint64_t framesRecorded{0};
+        uint64_t framesCaptured{0};
+
+        //Fails for swapchain formats texelSize doesn't know, their copies couldn't be sized.
+        bool create(
+            VkPhysicalDevice physicalDevice,
+            VkDevice logicalDevice,
+            VkCommandPool commandPool,
+            uint32_t framesInFlight,
+            VkFormat format,
+            ReadbackConfig config
+        );
+        void destroy(VkDevice logicalDevice);
+
+        //Call once the frame's in flight fence has signaled. Hands that frame's pixels to the writer.
+        void collect(VkDevice logicalDevice, uint32_t frameIndex);
+
+        //Records the copy of a presentable image (in PRESENT_SRC layout) into the frame's readback buffer.
+        //The returned command buffer must be submitted after the frame's rendering and before present. Null when
+        //the format can't be read back, IE the swapchain was recreated with a format create didn't check.
+        VkCommandBuffer record(VkDevice logicalDevice, uint32_t frameIndex, VkImage image, VkExtent2D extent, VkFormat format);
+    };
+
+}
+
+namespace Vulkan {
+    //Bytes per texel of the formats a surface is likely to offer, 0 for anything else.
+    uint32_t texelSize(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R5G6B5_UNORM_PACK16: case VK_FORMAT_B5G6R5_UNORM_PACK16:
+            case VK_FORMAT_A1R5G5B5_UNORM_PACK16: case VK_FORMAT_R5G5B5A1_UNORM_PACK16: case VK_FORMAT_B5G5R5A1_UNORM_PACK16:
+            case VK_FORMAT_R4G4B4A4_UNORM_PACK16: case VK_FORMAT_B4G4R4A4_UNORM_PACK16:
+                return 2;
+            case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB:
+            case VK_FORMAT_A8B8G8R8_UNORM_PACK32: case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+            case VK_FORMAT_A2R10G10B10_UNORM_PACK32: case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+            case VK_FORMAT_B10G11R11_UFLOAT_PACK32: case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+                return 4;
+            case VK_FORMAT_R16G16B16A16_UNORM: case VK_FORMAT_R16G16B16A16_SFLOAT:
+                return 8;
+            case VK_FORMAT_R32G32B32A32_SFLOAT:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    bool isBgra(VkFormat format) {
+        return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    }
+
+    bool isRgba(VkFormat format) {
+        return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+    }
+
+    //Rearranges BGRA pixels into RGBA in place.
+    void swizzleToRgba(CapturedFrame& frame) {
+        if (!isBgra(frame.format)) {
+            return;
+        }
+        for (size_t i = 0; i + 3 < frame.pixels.size(); i += 4) {
+            std::swap(frame.pixels[i], frame.pixels[i + 2]);
+        }
+        frame.format = VK_FORMAT_R8G8B8A8_UNORM;
+    }
+
+    constexpr std::array<uint32_t, 256> crcTable = []() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void appendPngChunk(std::vector<uint8_t>& out, const char (&type)[5], const std::vector<uint8_t>& data) {
+        appendBigEndian(out, static_cast<uint32_t>(data.size()));
+        size_t typeStart = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        appendBigEndian(out, crc32(0, out.data() + typeStart, out.size() - typeStart));
+    }
+
+    //Minimal RGBA8 PNG writer. Uses stored (uncompressed) deflate blocks, which keeps the writer thread cheap and
+    //dependency free at the cost of file size.
+    std::vector<uint8_t> encodePng(const CapturedFrame& frame) {
+        uint32_t width = frame.extent.width;
+        uint32_t height = frame.extent.height;
+        size_t rowSize = static_cast<size_t>(width) * 4;
+
+        //Every scanline is prefixed with filter type 0 (none).
+        std::vector<uint8_t> scanlines;
+        scanlines.reserve((rowSize + 1) * height);
+        for (uint32_t y = 0; y < height; y++) {
+            scanlines.push_back(0);
+            auto row = frame.pixels.begin() + y * rowSize;
+            scanlines.insert(scanlines.end(), row, row + rowSize);
+        }
+
+        std::vector<uint8_t> zlib = {0x78, 0x01};
+        constexpr size_t maxStoredBlock = 65535;
+        for (size_t offset = 0; offset < scanlines.size() || offset == 0; offset += maxStoredBlock) {
+            size_t blockSize = std::min(maxStoredBlock, scanlines.size() - offset);
+            bool last = offset + blockSize >= scanlines.size();
+            zlib.push_back(last ? 1 : 0);
+            zlib.push_back(static_cast<uint8_t>(blockSize));
+            zlib.push_back(static_cast<uint8_t>(blockSize >> 8));
+            zlib.push_back(static_cast<uint8_t>(~blockSize));
+            zlib.push_back(static_cast<uint8_t>(~blockSize >> 8));
+            zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+            if (last) {
+                break;
+            }
+        }
+
+        uint32_t a = 1, b = 0;
+        for (uint8_t byte : scanlines) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        appendBigEndian(zlib, (b << 16) | a);
+
+        std::vector<uint8_t> header;
+        appendBigEndian(header, width);
+        appendBigEndian(header, height);
+        header.insert(header.end(), {8, 6, 0, 0, 0}); //8 bit depth, RGBA, deflate, no filter, no interlace.
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        appendPngChunk(png, "IHDR", header);
+        appendPngChunk(png, "IDAT", zlib);
+        appendPngChunk(png, "IEND", {});
+        return png;
+    }
+
+    std::vector<uint8_t> encodePpm(const CapturedFrame& frame) {
+        std::string header = std::format("P6\n{} {}\n255\n", frame.extent.width, frame.extent.height);
+        std::vector<uint8_t> ppm(header.begin(), header.end());
+        ppm.reserve(ppm.size() + frame.pixels.size() / 4 * 3);
+        for (size_t i = 0; i + 3 < frame.pixels.size(); i += 4) {
+            ppm.insert(ppm.end(), frame.pixels.begin() + i, frame.pixels.begin() + i + 3);
+        }
+        return ppm;
+    }
+
+    void writeFrame(const ReadbackConfig& config, CapturedFrame& frame) {
+        auto format = config.format;
+        if (format != ImageFileFormat::Raw && !isBgra(frame.format) && !isRgba(frame.format)) {
+            Logging::warning("Readback format {} can't be encoded as an image, writing raw bytes.", static_cast<int>(frame.format));
+            format = ImageFileFormat::Raw;
+        }
+
+        std::vector<uint8_t> encoded;
+        std::string name;
+        switch (format) {
+            case ImageFileFormat::Png:
+                swizzleToRgba(frame);
+                encoded = encodePng(frame);
+                name = std::format("frame_{:06}.png", frame.frameNumber);
+                break;
+            case ImageFileFormat::Ppm:
+                swizzleToRgba(frame);
+                encoded = encodePpm(frame);
+                name = std::format("frame_{:06}.ppm", frame.frameNumber);
+                break;
+            case ImageFileFormat::Raw:
+                encoded = std::move(frame.pixels);
+                name = std::format("frame_{:06}_{}x{}_vkformat{}.raw", frame.frameNumber, frame.extent.width, frame.extent.height, static_cast<int>(frame.format));
+                break;
+        }
+
+        std::ofstream file(config.directory / name, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            Logging::failure("Couldn't open {} for writing.", (config.directory / name).string());
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+    }
+
+    void ImageSequenceWriter::start(ReadbackConfig writerConfig) {
+        config = std::move(writerConfig);
+        stopping = false;
+
+        std::error_code error;
+        std::filesystem::create_directories(config.directory, error);
+        if (error) {
+            Logging::failure("Couldn't create capture directory {}: {}", config.directory.string(), error.message());
+        }
+
+        worker = std::thread([this]() {
+            while (true) {
+                CapturedFrame frame;
+                {
+                    std::unique_lock lock(mutex);
+                    queueChanged.wait(lock, [this]() { return stopping || !queue.empty(); });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    frame = std::move(queue.front());
+                    queue.pop_front();
+                }
+                queueChanged.notify_all();
+                writeFrame(config, frame);
+            }
+        });
+    }
+
+    void ImageSequenceWriter::push(CapturedFrame frame) {
+        {
+            std::unique_lock lock(mutex);
+            //Only reached when the disk can't keep up, in which case memory use would otherwise grow without bound.
+            queueChanged.wait(lock, [this]() { return queue.size() < config.maxQueuedFrames; });
+            queue.push_back(std::move(frame));
+        }
+        queueChanged.notify_all();
+    }
+
+    void ImageSequenceWriter::stop() {
+        if (!worker.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        worker.join();
+    }
+
+    ImageSequenceWriter::~ImageSequenceWriter() {
+        stop();
+    }
+
+    bool FrameReadback::create(
+        VkPhysicalDevice device,
+        VkDevice logicalDevice,
+        VkCommandPool commandPool,
+        uint32_t framesInFlight,
+        VkFormat format,
+        ReadbackConfig config
+    ) {
+        if (texelSize(format) == 0) {
+            Logging::failure("Swapchain format {} has no known texel size, so frames can't be read back.", static_cast<int>(format));
+            return false;
+        }
+        physicalDevice = device;
+        slots.resize(framesInFlight);
+
+        //Host cached memory makes the CPU side read fast, it just needs an explicit invalidate.
+        memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        if (findMemoryType(physicalDevice, ~0u, memoryProperties) == UINT32_MAX) {
+            Logging::warning("No host cached memory available, frame readback will read uncached memory.");
+            memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        for (auto& slot : slots) {
+            if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &slot.commandBuffer) != VK_SUCCESS) {
+                Logging::failure("Failed to allocate readback command buffers.");
+                return false;
+            }
+        }
+
+        writer.start(std::move(config));
+        return true;
+    }
+
+    void FrameReadback::destroy(VkDevice logicalDevice) {
+        //The device is idle by now, so every pending slot is complete.
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            collect(logicalDevice, i);
+        }
+        writer.stop();
+
+        for (auto& slot : slots) {
+            if (slot.buffer != VK_NULL_HANDLE) {
+                vkUnmapMemory(logicalDevice, slot.memory);
+                vkDestroyBuffer(logicalDevice, slot.buffer, nullptr);
+                vkFreeMemory(logicalDevice, slot.memory, nullptr);
+            }
+        }
+        slots.clear();
+        Logging::info("Frame readback wrote {} frames.", framesCaptured);
+    }
+
+    void FrameReadback::collect(VkDevice logicalDevice, uint32_t frameIndex) {
+        auto& slot = slots[frameIndex];
+        if (!slot.pending) {
+            return;
+        }
+        slot.pending = false;
+
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = slot.memory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        vkInvalidateMappedMemoryRanges(logicalDevice, 1, &range);
+
+        CapturedFrame frame{slot.frameNumber, slot.extent, slot.format, {}};
+        auto* pixels = static_cast<const uint8_t*>(slot.mapped);
+        frame.pixels.assign(pixels, pixels + slot.size);
+        writer.push(std::move(frame));
+        framesCaptured++;
+    }
+
+    VkCommandBuffer FrameReadback::record(VkDevice logicalDevice, uint32_t frameIndex, VkImage image, VkExtent2D extent, VkFormat format) {
+        auto& slot = slots[frameIndex];
+        if (texelSize(format) == 0) {
+            Logging::warning("Swapchain format {} has no known texel size, skipping frame readback.", static_cast<int>(format));
+            return VK_NULL_HANDLE;
+        }
+        VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * texelSize(format);
+
+        //The previous use of this slot retired with its frame's fence, so it is safe to reallocate on resize.
+        if (slot.size != size) {
+            if (slot.buffer != VK_NULL_HANDLE) {
+                vkUnmapMemory(logicalDevice, slot.memory);
+                vkDestroyBuffer(logicalDevice, slot.buffer, nullptr);
+                vkFreeMemory(logicalDevice, slot.memory, nullptr);
+            }
+            std::tie(slot.buffer, slot.memory) = createBuffer(
+                physicalDevice, logicalDevice, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, memoryProperties);
+            vkMapMemory(logicalDevice, slot.memory, 0, size, 0, &slot.mapped);
+            slot.size = size;
+        }
+
+        VkCommandBuffer commandBuffer = slot.commandBuffer;
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        VkImageMemoryBarrier toTransfer{};
+        toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        toTransfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        toTransfer.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.image = image;
+        toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {extent.width, extent.height, 1};
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+        VkImageMemoryBarrier toPresent = toTransfer;
+        toPresent.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        toPresent.dstAccessMask = 0;
+        toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkBufferMemoryBarrier toHost{};
+        toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toHost.buffer = slot.buffer;
+        toHost.offset = 0;
+        toHost.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 1, &toHost, 1, &toPresent);
+
+        vkEndCommandBuffer(commandBuffer);
+
+        slot.pending = true;
+        slot.frameNumber = framesRecorded++;
+        slot.extent = extent;
+        slot.format = format;
+        return commandBuffer;
+    }
+}
@@ -0,0 +1,400 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module ShaderObjects;
+
+import std;
+import Logging;
+import PhysicalDevice;
+import PipelineState;
+import ShaderCode;
+
+/*
+    Optional VK_EXT_shader_object backend.
+
+    Instead of one monolithic VkPipeline per state combination, the vertex and fragment shaders are created once
+    as linked VkShaderEXT objects and every piece of fixed function state is set while recording. A new
+    blend or raster combination then costs a few vkCmdSet* calls instead of a pipeline compile.
+    Shader objects render with dynamic rendering rather than a VkRenderPass, see recordCommandBuffer.
+*/
+
+export namespace Vulkan {
+
+    //Dynamic rendering is core in 1.3, on 1.1 it needs its extension and that extension's dependencies.
+    const std::vector<const char*> shaderObjectExtensions = {
+        VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+        VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+        VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+        VK_EXT_SHADER_OBJECT_EXTENSION_NAME
+    };
+
+    //Feature structs to chain into device creation when shader objects are used.
+    struct ShaderObjectFeatures {
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR, nullptr, VK_TRUE};
+        VkPhysicalDeviceShaderObjectFeaturesEXT shaderObject{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT, nullptr, VK_TRUE};
+
+        void* link(void* next) {
+            shaderObject.pNext = next;
+            dynamicRendering.pNext = &shaderObject;
+            return &dynamicRendering;
+        }
+    };
+
+    bool supportsShaderObjects(VkPhysicalDevice physicalDevice);
+
+    //Extension entry points, none of these are exported by the 1.1 loader.
+    struct ShaderObjectFunctions {
+        PFN_vkCreateShadersEXT createShaders{nullptr};
+        PFN_vkDestroyShaderEXT destroyShader{nullptr};
+        PFN_vkCmdBindShadersEXT bindShaders{nullptr};
+        PFN_vkCmdBeginRenderingKHR beginRendering{nullptr};
+        PFN_vkCmdEndRenderingKHR endRendering{nullptr};
+        PFN_vkCmdSetViewportWithCountEXT setViewportWithCount{nullptr};
+        PFN_vkCmdSetScissorWithCountEXT setScissorWithCount{nullptr};
+        PFN_vkCmdSetVertexInputEXT setVertexInput{nullptr};
+        PFN_vkCmdSetPrimitiveTopologyEXT setPrimitiveTopology{nullptr};
+        PFN_vkCmdSetPrimitiveRestartEnableEXT setPrimitiveRestartEnable{nullptr};
+        PFN_vkCmdSetRasterizerDiscardEnableEXT setRasterizerDiscardEnable{nullptr};
+        PFN_vkCmdSetPolygonModeEXT setPolygonMode{nullptr};
+        PFN_vkCmdSetCullModeEXT setCullMode{nullptr};
+        PFN_vkCmdSetFrontFaceEXT setFrontFace{nullptr};
+        PFN_vkCmdSetDepthBiasEnableEXT setDepthBiasEnable{nullptr};
+        PFN_vkCmdSetRasterizationSamplesEXT setRasterizationSamples{nullptr};
+        PFN_vkCmdSetSampleMaskEXT setSampleMask{nullptr};
+        PFN_vkCmdSetAlphaToCoverageEnableEXT setAlphaToCoverageEnable{nullptr};
+        PFN_vkCmdSetDepthTestEnableEXT setDepthTestEnable{nullptr};
+        PFN_vkCmdSetDepthWriteEnableEXT setDepthWriteEnable{nullptr};
+        PFN_vkCmdSetDepthCompareOpEXT setDepthCompareOp{nullptr};
+        PFN_vkCmdSetStencilTestEnableEXT setStencilTestEnable{nullptr};
+        PFN_vkCmdSetColorBlendEnableEXT setColorBlendEnable{nullptr};
+        PFN_vkCmdSetColorBlendEquationEXT setColorBlendEquation{nullptr};
+        PFN_vkCmdSetColorWriteMaskEXT setColorWriteMask{nullptr};
+
+        bool load(VkDevice logicalDevice);
+    };
+
+    struct ShaderObjectSet {
+        VkShaderEXT vertex{VK_NULL_HANDLE};
+        VkShaderEXT fragment{VK_NULL_HANDLE};
+
+        bool valid() const {
+            return vertex != VK_NULL_HANDLE && fragment != VK_NULL_HANDLE;
+        }
+    };
+
+    //Linked vertex + fragment shader objects, keyed by the shader half of a PipelineState. Every raster, blend and
+    //vertex variant of the same shaders shares one entry.
+    struct ShaderObjectCache {
+        //The shader half of a PipelineState, compared in full so a hash collision can't return other shaders.
+        struct Key {
+            std::filesystem::path vertexShader;
+            std::filesystem::path fragmentShader;
+            SpecializationConstants constants;
+            bool operator==(const Key&) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct RetiredShaders {
+            ShaderObjectSet shaders;
+            uint64_t retiredAtFrame;
+        };
+
+        VkDevice logicalDevice{VK_NULL_HANDLE};
+        const ShaderObjectFunctions* functions{nullptr};
+        std::unordered_map<Key, ShaderObjectSet, KeyHash> shaders;
+        std::vector<RetiredShaders> retired;
+
+        void create(VkDevice device, const ShaderObjectFunctions& shaderObjectFunctions);
+        void destroy();
+
+        //Creates the shaders on first use, which is cheap next to a pipeline compile. Invalid if creation failed.
+        ShaderObjectSet request(
+            const PipelineState& state,
+            std::span<const VkDescriptorSetLayout> setLayouts,
+            std::span<const VkPushConstantRange> pushConstants,
+            bool preferDiskShaders = false
+        );
+
+        //Hot reload, drops every entry using this SPIR-V so the next request rebuilds it. The old shaders are
+        //destroyed by collectRetired once every frame that could still use them has retired.
+        void reload(const std::filesystem::path& spirvPath, uint64_t frameNumber);
+        void collectRetired(uint64_t frameNumber, uint32_t framesInFlight);
+
+        static Key key(const PipelineState& state);
+    };
+
+    void bindShaderObjects(const ShaderObjectFunctions& functions, VkCommandBuffer commandBuffer, const ShaderObjectSet& shaders);
+    //Sets everything the PipelineState would have baked into a VkPipeline. Dynamic state doesn't carry across
+    //command buffers, so this runs once per recording.
+    void setDynamicState(const ShaderObjectFunctions& functions, VkCommandBuffer commandBuffer, const PipelineState& state, VkExtent2D viewportExtent);
+
+    //Everything recordCommandBuffer needs to draw with shader objects instead of a pipeline.
+    struct ShaderObjectDraw {
+        const ShaderObjectFunctions* functions{nullptr};
+        ShaderObjectSet shaders;
+        const PipelineState* state{nullptr};
+        //The swapchain image being rendered, filled in by drawFrame after acquire.
+        VkImage targetImage{VK_NULL_HANDLE};
+        VkImageView targetView{VK_NULL_HANDLE};
+    };
+
+}
+
+namespace Vulkan {
+    bool supportsShaderObjects(VkPhysicalDevice physicalDevice) {
+        if (!checkDeviceExtensionSupport(physicalDevice, shaderObjectExtensions)) {
+            return false;
+        }
+
+        VkPhysicalDeviceShaderObjectFeaturesEXT shaderObject{};
+        shaderObject.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering{};
+        dynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        dynamicRendering.pNext = &shaderObject;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &dynamicRendering;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        return shaderObject.shaderObject == VK_TRUE && dynamicRendering.dynamicRendering == VK_TRUE;
+    }
+
+    bool ShaderObjectFunctions::load(VkDevice logicalDevice) {
+        auto loadFunction = [&](auto& function, const char* name) {
+            function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(vkGetDeviceProcAddr(logicalDevice, name));
+            if (function == nullptr) {
+                Logging::failure("Couldn't load {}.", name);
+            }
+            return function != nullptr;
+        };
+
+        return loadFunction(createShaders, "vkCreateShadersEXT") &
+            loadFunction(destroyShader, "vkDestroyShaderEXT") &
+            loadFunction(bindShaders, "vkCmdBindShadersEXT") &
+            loadFunction(beginRendering, "vkCmdBeginRenderingKHR") &
+            loadFunction(endRendering, "vkCmdEndRenderingKHR") &
+            loadFunction(setViewportWithCount, "vkCmdSetViewportWithCountEXT") &
+            loadFunction(setScissorWithCount, "vkCmdSetScissorWithCountEXT") &
+            loadFunction(setVertexInput, "vkCmdSetVertexInputEXT") &
+            loadFunction(setPrimitiveTopology, "vkCmdSetPrimitiveTopologyEXT") &
+            loadFunction(setPrimitiveRestartEnable, "vkCmdSetPrimitiveRestartEnableEXT") &
+            loadFunction(setRasterizerDiscardEnable, "vkCmdSetRasterizerDiscardEnableEXT") &
+            loadFunction(setPolygonMode, "vkCmdSetPolygonModeEXT") &
+            loadFunction(setCullMode, "vkCmdSetCullModeEXT") &
+            loadFunction(setFrontFace, "vkCmdSetFrontFaceEXT") &
+            loadFunction(setDepthBiasEnable, "vkCmdSetDepthBiasEnableEXT") &
+            loadFunction(setRasterizationSamples, "vkCmdSetRasterizationSamplesEXT") &
+            loadFunction(setSampleMask, "vkCmdSetSampleMaskEXT") &
+            loadFunction(setAlphaToCoverageEnable, "vkCmdSetAlphaToCoverageEnableEXT") &
+            loadFunction(setDepthTestEnable, "vkCmdSetDepthTestEnableEXT") &
+            loadFunction(setDepthWriteEnable, "vkCmdSetDepthWriteEnableEXT") &
+            loadFunction(setDepthCompareOp, "vkCmdSetDepthCompareOpEXT") &
+            loadFunction(setStencilTestEnable, "vkCmdSetStencilTestEnableEXT") &
+            loadFunction(setColorBlendEnable, "vkCmdSetColorBlendEnableEXT") &
+            loadFunction(setColorBlendEquation, "vkCmdSetColorBlendEquationEXT") &
+            loadFunction(setColorWriteMask, "vkCmdSetColorWriteMaskEXT");
+    }
+
+    void ShaderObjectCache::create(VkDevice device, const ShaderObjectFunctions& shaderObjectFunctions) {
+        logicalDevice = device;
+        functions = &shaderObjectFunctions;
+    }
+
+    void destroyShaderSet(VkDevice logicalDevice, const ShaderObjectFunctions& functions, const ShaderObjectSet& shaders) {
+        if (shaders.vertex != VK_NULL_HANDLE) {
+            functions.destroyShader(logicalDevice, shaders.vertex, nullptr);
+        }
+        if (shaders.fragment != VK_NULL_HANDLE) {
+            functions.destroyShader(logicalDevice, shaders.fragment, nullptr);
+        }
+    }
+
+    void ShaderObjectCache::destroy() {
+        for (auto& [key, cached] : shaders) {
+            destroyShaderSet(logicalDevice, *functions, cached);
+        }
+        for (auto& old : retired) {
+            destroyShaderSet(logicalDevice, *functions, old.shaders);
+        }
+        shaders.clear();
+        retired.clear();
+    }
+
+    ShaderObjectCache::Key ShaderObjectCache::key(const PipelineState& state) {
+        return {state.vertexShader.lexically_normal(), state.fragmentShader.lexically_normal(), state.constants};
+    }
+
+    size_t ShaderObjectCache::KeyHash::operator()(const Key& key) const {
+        StateHasher hasher;
+        hasher.add(key.vertexShader.generic_string());
+        hasher.add(key.fragmentShader.generic_string());
+        hasher.add(key.constants.stages);
+        hasher.add(key.constants.entries.size());
+        for (const auto& entry : key.constants.entries) {
+            hasher.add(entry.constantID);
+            hasher.add(entry.offset);
+            hasher.add(entry.size);
+        }
+        hasher.bytes(key.constants.data.data(), key.constants.data.size());
+        return static_cast<size_t>(hasher.value);
+    }
+
+    ShaderObjectSet ShaderObjectCache::request(
+        const PipelineState& state,
+        std::span<const VkDescriptorSetLayout> setLayouts,
+        std::span<const VkPushConstantRange> pushConstants,
+        bool preferDiskShaders) {
+        auto shaderKey = key(state);
+        if (auto found = shaders.find(shaderKey); found != shaders.end()) {
+            return found->second;
+        }
+
+        auto vertexCode = Shaders::loadSpirv(state.vertexShader, preferDiskShaders);
+        auto fragmentCode = Shaders::loadSpirv(state.fragmentShader, preferDiskShaders);
+        if (!vertexCode || !fragmentCode) {
+            Logging::failure("Couldn't find or use shader files for shader objects {}.", state.name);
+            return {};
+        }
+
+        VkSpecializationInfo specializationInfo = state.constants.info();
+
+        std::array<VkShaderCreateInfoEXT, 2> createInfos{};
+        for (auto& createInfo : createInfos) {
+            createInfo.sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+            //Linked stages let the driver optimize across the interface like it would inside a pipeline.
+            createInfo.flags = VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+            createInfo.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+            createInfo.pName = "main";
+            createInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+            createInfo.pSetLayouts = setLayouts.data();
+            createInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstants.size());
+            createInfo.pPushConstantRanges = pushConstants.data();
+        }
+
+        createInfos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        createInfos[0].nextStage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        createInfos[0].codeSize = vertexCode->words.size_bytes();
+        createInfos[0].pCode = vertexCode->words.data();
+
+        createInfos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        createInfos[1].nextStage = 0;
+        createInfos[1].codeSize = fragmentCode->words.size_bytes();
+        createInfos[1].pCode = fragmentCode->words.data();
+
+        for (auto& createInfo : createInfos) {
+            if (!state.constants.empty() && (state.constants.stages & createInfo.stage)) {
+                createInfo.pSpecializationInfo = &specializationInfo;
+            }
+        }
+
+        std::array<VkShaderEXT, 2> created{VK_NULL_HANDLE, VK_NULL_HANDLE};
+        auto createStart = std::chrono::steady_clock::now();
+        VkResult result = functions->createShaders(logicalDevice, static_cast<uint32_t>(createInfos.size()), createInfos.data(), nullptr, created.data());
+        std::chrono::duration<double, std::milli> createTime = std::chrono::steady_clock::now() - createStart;
+
+        ShaderObjectSet set{created[0], created[1]};
+        if (result != VK_SUCCESS || !set.valid()) {
+            Logging::failure("Failed to create shader objects for {}.", state.name);
+            destroyShaderSet(logicalDevice, *functions, set);
+            return {};
+        }
+
+        Logging::info("Shader objects {}: {:.3f} ms.", state.name, createTime.count());
+        shaders.emplace(std::move(shaderKey), set);
+        return set;
+    }
+
+    void ShaderObjectCache::reload(const std::filesystem::path& spirvPath, uint64_t frameNumber) {
+        auto changed = spirvPath.lexically_normal();
+        std::erase_if(shaders, [&](const auto& entry) {
+            const auto& [key, cached] = entry;
+            if (key.vertexShader != changed && key.fragmentShader != changed) {
+                return false;
+            }
+            retired.push_back({cached, frameNumber});
+            return true;
+        });
+    }
+
+    void ShaderObjectCache::collectRetired(uint64_t frameNumber, uint32_t framesInFlight) {
+        std::erase_if(retired, [&](const RetiredShaders& old) {
+            if (frameNumber < old.retiredAtFrame + framesInFlight) {
+                return false;
+            }
+            destroyShaderSet(logicalDevice, *functions, old.shaders);
+            return true;
+        });
+    }
+
+    void bindShaderObjects(const ShaderObjectFunctions& functions, VkCommandBuffer commandBuffer, const ShaderObjectSet& shaders) {
+        //Stages without a shader are bound to null explicitly, nothing is inherited from a pipeline.
+        VkShaderStageFlagBits stages[] = {
+            VK_SHADER_STAGE_VERTEX_BIT,
+            VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+            VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+            VK_SHADER_STAGE_GEOMETRY_BIT,
+            VK_SHADER_STAGE_FRAGMENT_BIT
+        };
+        VkShaderEXT bound[] = {shaders.vertex, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, shaders.fragment};
+        functions.bindShaders(commandBuffer, 5, stages, bound);
+    }
+
+    void setDynamicState(const ShaderObjectFunctions& functions, VkCommandBuffer commandBuffer, const PipelineState& state, VkExtent2D viewportExtent) {
+        //State this renderer never changes.
+        functions.setRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+        functions.setPrimitiveRestartEnable(commandBuffer, VK_FALSE);
+        functions.setDepthBiasEnable(commandBuffer, VK_FALSE);
+        functions.setStencilTestEnable(commandBuffer, VK_FALSE);
+        functions.setAlphaToCoverageEnable(commandBuffer, VK_FALSE);
+        vkCmdSetLineWidth(commandBuffer, 1.0f);
+
+        VkViewport viewport{0.0f, 0.0f, static_cast<float>(viewportExtent.width), static_cast<float>(viewportExtent.height), 0.0f, 1.0f};
+        VkRect2D scissor{{0, 0}, viewportExtent};
+        functions.setViewportWithCount(commandBuffer, 1, &viewport);
+        functions.setScissorWithCount(commandBuffer, 1, &scissor);
+
+        std::vector<VkVertexInputBindingDescription2EXT> bindings;
+        for (const auto& binding : state.vertexLayout.bindings) {
+            bindings.push_back({VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT, nullptr, binding.binding, binding.stride, binding.inputRate, 1});
+        }
+        std::vector<VkVertexInputAttributeDescription2EXT> attributes;
+        for (const auto& attribute : state.vertexLayout.attributes) {
+            attributes.push_back({VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT, nullptr, attribute.location, attribute.binding, attribute.format, attribute.offset});
+        }
+        functions.setVertexInput(commandBuffer,
+            static_cast<uint32_t>(bindings.size()), bindings.data(),
+            static_cast<uint32_t>(attributes.size()), attributes.data());
+
+        functions.setPrimitiveTopology(commandBuffer, state.raster.topology);
+        functions.setPolygonMode(commandBuffer, state.raster.polygonMode);
+        functions.setCullMode(commandBuffer, state.raster.cullMode);
+        functions.setFrontFace(commandBuffer, state.raster.frontFace);
+        VkSampleMask sampleMask = ~0u;
+        functions.setRasterizationSamples(commandBuffer, state.raster.samples);
+        functions.setSampleMask(commandBuffer, state.raster.samples, &sampleMask);
+
+        //Matches createGraphicsPipeline, depth state only applies when there is a depth target.
+        bool hasDepth = state.targets.depth != VK_FORMAT_UNDEFINED;
+        functions.setDepthTestEnable(commandBuffer, hasDepth && state.depth.testEnable ? VK_TRUE : VK_FALSE);
+        functions.setDepthWriteEnable(commandBuffer, hasDepth && state.depth.writeEnable ? VK_TRUE : VK_FALSE);
+        functions.setDepthCompareOp(commandBuffer, state.depth.compareOp);
+
+        //Every color target shares the one blend state, as in createGraphicsPipeline.
+        const auto& blendState = state.blend;
+        uint32_t attachmentCount = static_cast<uint32_t>(std::max<size_t>(state.targets.color.size(), 1));
+        std::vector<VkBool32> enables(attachmentCount, blendState.enable ? VK_TRUE : VK_FALSE);
+        std::vector<VkColorBlendEquationEXT> equations(attachmentCount, {
+            blendState.srcColor, blendState.dstColor, blendState.colorOp,
+            blendState.srcAlpha, blendState.dstAlpha, blendState.alphaOp
+        });
+        std::vector<VkColorComponentFlags> writeMasks(attachmentCount, blendState.writeMask);
+        functions.setColorBlendEnable(commandBuffer, 0, attachmentCount, enables.data());
+        functions.setColorBlendEquation(commandBuffer, 0, attachmentCount, equations.data());
+        functions.setColorWriteMask(commandBuffer, 0, attachmentCount, writeMasks.data());
+    }
+}
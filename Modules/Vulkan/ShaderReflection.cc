@@ -0,0 +1,797 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+export module ShaderReflection;
+
+import std;
+import Logging;
+import PipelineState;
+import ShaderCode;
+
+/*
+    Reads descriptor bindings, push constant ranges and vertex inputs straight out of SPIR-V, so layouts are built
+    from the shaders themselves instead of being kept in sync by hand.
+
+    Only the handful of instructions that describe the shader interface are looked at, see
+    <https://registry.khronos.org/SPIR-V/specs/unified1/SPIRV.html> section 3 for the opcode and enum values.
+    Stages are reflected one at a time then merged, IE vertex + fragment for a graphics pipeline.
+*/
+
+export namespace Vulkan {
+
+    struct DescriptorSetReflection {
+        uint32_t set;
+        //Sorted by binding. A descriptorCount of 0 is a runtime sized array.
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+    };
+
+    struct VertexInputReflection {
+        uint32_t location;
+        VkFormat format;
+    };
+
+    struct ShaderReflection {
+        VkShaderStageFlags stages{0};
+        //Sorted by set.
+        std::vector<DescriptorSetReflection> sets;
+        std::vector<VkPushConstantRange> pushConstants;
+        //Vertex stage only, sorted by location.
+        std::vector<VertexInputReflection> vertexInputs;
+        //Compute stage only, the local_size_x/y/z of the workgroup.
+        std::array<uint32_t, 3> localSize{1, 1, 1};
+        //The constant_id behind each local size dimension, UINT32_MAX where it's fixed. localSize holds the
+        //shader's default, specialization can replace it.
+        std::array<uint32_t, 3> localSizeConstantIds{UINT32_MAX, UINT32_MAX, UINT32_MAX};
+
+        //Folds another stage in, bindings used by both get both stage flags. False if the stages disagree on a binding.
+        bool merge(const ShaderReflection& other);
+
+        //A single interleaved binding with the attributes tightly packed in location order.
+        VertexLayout vertexLayout(uint32_t binding = 0) const;
+        //True when every vertex input is fed by an attribute of the same format.
+        bool matches(const VertexLayout& layout) const;
+    };
+
+    std::optional<ShaderReflection> reflectSpirv(std::span<const uint32_t> code);
+
+    //Reflection results cached by SPIR-V content, plus the descriptor set and pipeline layouts built from them,
+    //deduplicated by value so pipelines with the same interface share layout objects.
+    struct ShaderReflectionCache {
+        //Everything a cached value was built from, the SPIR-V words or the layout description. Compared in full on
+        //lookup, the hash only picks the bucket.
+        struct Key {
+            std::vector<uint64_t> words;
+            bool operator==(const Key&) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                StateHasher hasher;
+                hasher.bytes(key.words.data(), key.words.size() * sizeof(uint64_t));
+                return static_cast<size_t>(hasher.value);
+            }
+        };
+
+        std::mutex mutex;
+        std::unordered_map<Key, ShaderReflection, KeyHash> shaders;
+        std::unordered_map<Key, VkDescriptorSetLayout, KeyHash> setLayouts;
+        std::unordered_map<Key, VkPipelineLayout, KeyHash> pipelineLayouts;
+        //Layouts owned elsewhere that replace reflection for a whole set number, IE the bindless table.
+        std::unordered_map<uint32_t, VkDescriptorSetLayout> externalSetLayouts;
+        //Set numbers whose layouts are created for vkCmdPushDescriptorSetKHR rather than allocation.
+        std::unordered_set<uint32_t> pushDescriptorSets;
+        //Added to every layout created here, IE DESCRIPTOR_BUFFER. Set before any layout is requested.
+        VkDescriptorSetLayoutCreateFlags setLayoutFlags{0};
+
+        //Thread safe. Null if the code isn't valid SPIR-V.
+        const ShaderReflection* reflect(std::span<const uint32_t> code);
+        //Thread safe. Reflects every stage and merges them, see Shaders::loadSpirv for where the code comes from.
+        std::optional<ShaderReflection> reflectFiles(std::initializer_list<std::filesystem::path> paths, bool preferDisk = false);
+
+        //Thread safe. Shaders using this set number get layout instead of one built from their bindings.
+        void useSetLayout(uint32_t set, VkDescriptorSetLayout layout);
+        //Thread safe. Needs VK_KHR_push_descriptor, and has to be called before layouts for the set are requested.
+        void usePushDescriptors(uint32_t set);
+        //Thread safe. Indexed by set number, sets the shaders skip get an empty layout.
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts(VkDevice logicalDevice, const ShaderReflection& reflection);
+        //Thread safe.
+        VkPipelineLayout pipelineLayout(VkDevice logicalDevice, const ShaderReflection& reflection);
+
+        void destroy(VkDevice logicalDevice);
+    };
+
+}
+
+namespace Vulkan {
+    constexpr uint32_t spirvMagic = 0x07230203;
+
+    namespace Op {
+        constexpr uint32_t EntryPoint = 15;
+        constexpr uint32_t ExecutionMode = 16;
+        constexpr uint32_t TypeInt = 21;
+        constexpr uint32_t TypeFloat = 22;
+        constexpr uint32_t TypeVector = 23;
+        constexpr uint32_t TypeMatrix = 24;
+        constexpr uint32_t TypeImage = 25;
+        constexpr uint32_t TypeSampler = 26;
+        constexpr uint32_t TypeSampledImage = 27;
+        constexpr uint32_t TypeArray = 28;
+        constexpr uint32_t TypeRuntimeArray = 29;
+        constexpr uint32_t TypeStruct = 30;
+        constexpr uint32_t TypePointer = 32;
+        constexpr uint32_t Constant = 43;
+        constexpr uint32_t ConstantComposite = 44;
+        constexpr uint32_t SpecConstant = 50;
+        constexpr uint32_t SpecConstantComposite = 51;
+        constexpr uint32_t Variable = 59;
+        constexpr uint32_t Decorate = 71;
+        constexpr uint32_t MemberDecorate = 72;
+        constexpr uint32_t ExecutionModeId = 331;
+        constexpr uint32_t TypeAccelerationStructure = 5341;
+    }
+
+    namespace Decoration {
+        constexpr uint32_t SpecId = 1;
+        constexpr uint32_t Block = 2;
+        constexpr uint32_t BufferBlock = 3;
+        constexpr uint32_t ArrayStride = 6;
+        constexpr uint32_t MatrixStride = 7;
+        constexpr uint32_t BuiltIn = 11;
+        constexpr uint32_t Location = 30;
+        constexpr uint32_t Binding = 33;
+        constexpr uint32_t DescriptorSet = 34;
+        constexpr uint32_t Offset = 35;
+    }
+
+    namespace StorageClass {
+        constexpr uint32_t UniformConstant = 0;
+        constexpr uint32_t Input = 1;
+        constexpr uint32_t Uniform = 2;
+        constexpr uint32_t PushConstant = 9;
+        constexpr uint32_t StorageBuffer = 12;
+    }
+
+    constexpr uint32_t executionModeLocalSize = 17;
+    constexpr uint32_t executionModeLocalSizeId = 38;
+    constexpr uint32_t builtInWorkgroupSize = 25;
+    constexpr uint32_t dimBuffer = 5;
+    constexpr uint32_t dimSubpassData = 6;
+    constexpr uint32_t noValue = UINT32_MAX;
+
+    //Everything known about one SPIR-V id.
+    struct SpirvId {
+        uint32_t opcode{0};
+        //Words after the result id.
+        std::vector<uint32_t> operands;
+
+        uint32_t set{noValue};
+        uint32_t binding{noValue};
+        uint32_t location{noValue};
+        uint32_t arrayStride{0};
+        uint32_t specId{noValue};
+        bool builtIn{false};
+        bool block{false};
+        bool bufferBlock{false};
+
+        std::vector<uint32_t> memberOffsets;
+        std::vector<uint32_t> memberMatrixStrides;
+    };
+
+    VkShaderStageFlagBits stageFromExecutionModel(uint32_t executionModel) {
+        switch (executionModel) {
+            case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+            case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+            case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+            case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+            case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+            case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+            default: return static_cast<VkShaderStageFlagBits>(0);
+        }
+    }
+
+    struct SpirvModule {
+        std::vector<SpirvId> ids;
+        //Stands in for ids past the bound, so malformed input is ignored rather than read out of range.
+        SpirvId missing;
+
+        SpirvId& at(uint32_t id) {
+            return id < ids.size() ? ids[id] : missing;
+        }
+
+        //Peels pointers and arrays off a variable type, multiplying out fixed array lengths.
+        uint32_t elementType(uint32_t type, uint32_t& count) {
+            count = 1;
+            while (true) {
+                auto& info = at(type);
+                if (info.opcode == Op::TypePointer) {
+                    type = info.operands[1];
+                } else if (info.opcode == Op::TypeArray) {
+                    auto& length = at(info.operands[1]);
+                    count *= length.opcode == Op::Constant ? length.operands[1] : 1;
+                    type = info.operands[0];
+                } else if (info.opcode == Op::TypeRuntimeArray) {
+                    count = 0;
+                    type = info.operands[0];
+                } else {
+                    return type;
+                }
+            }
+        }
+
+        //Size in bytes of a type as laid out by its explicit offsets and strides.
+        uint32_t typeSize(uint32_t type, uint32_t matrixStride = 0) {
+            auto& info = at(type);
+            switch (info.opcode) {
+                case Op::TypeInt:
+                case Op::TypeFloat:
+                    return info.operands[0] / 8;
+                case Op::TypeVector:
+                    return info.operands[1] * typeSize(info.operands[0]);
+                case Op::TypeMatrix:
+                    return info.operands[1] * (matrixStride != 0 ? matrixStride : typeSize(info.operands[0]));
+                case Op::TypeArray: {
+                    auto& length = at(info.operands[1]);
+                    uint32_t count = length.opcode == Op::Constant ? length.operands[1] : 1;
+                    uint32_t stride = info.arrayStride != 0 ? info.arrayStride : typeSize(info.operands[0], matrixStride);
+                    return count * stride;
+                }
+                case Op::TypeStruct: {
+                    uint32_t size = 0;
+                    for (size_t member = 0; member < info.operands.size(); member++) {
+                        uint32_t offset = member < info.memberOffsets.size() && info.memberOffsets[member] != noValue ? info.memberOffsets[member] : size;
+                        uint32_t stride = member < info.memberMatrixStrides.size() ? info.memberMatrixStrides[member] : 0;
+                        size = std::max(size, offset + typeSize(info.operands[member], stride));
+                    }
+                    return size;
+                }
+                default:
+                    return 0;
+            }
+        }
+
+        std::optional<VkDescriptorType> descriptorType(uint32_t storageClass, uint32_t type) {
+            auto& info = at(type);
+            if (storageClass == StorageClass::StorageBuffer) {
+                return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            }
+            if (storageClass == StorageClass::Uniform) {
+                return info.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+            if (storageClass != StorageClass::UniformConstant) {
+                return {};
+            }
+
+            switch (info.opcode) {
+                case Op::TypeSampler:
+                    return VK_DESCRIPTOR_TYPE_SAMPLER;
+                case Op::TypeSampledImage:
+                    return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                case Op::TypeAccelerationStructure:
+                    return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+                case Op::TypeImage: {
+                    uint32_t dim = info.operands[1];
+                    //1 is used with a sampler, 2 is a storage image.
+                    bool storage = info.operands[5] == 2;
+                    if (dim == dimSubpassData) {
+                        return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                    }
+                    if (dim == dimBuffer) {
+                        return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                    }
+                    return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                }
+                default:
+                    return {};
+            }
+        }
+
+        VkFormat vertexFormat(uint32_t type) {
+            auto& info = at(type);
+            uint32_t components = 1;
+            uint32_t scalar = type;
+            if (info.opcode == Op::TypeVector) {
+                components = info.operands[1];
+                scalar = info.operands[0];
+            }
+
+            auto& scalarInfo = at(scalar);
+            if (components < 1 || components > 4 || scalarInfo.operands.empty() || scalarInfo.operands[0] != 32) {
+                return VK_FORMAT_UNDEFINED;
+            }
+
+            constexpr VkFormat floats[] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+            constexpr VkFormat ints[] = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+            constexpr VkFormat uints[] = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+
+            if (scalarInfo.opcode == Op::TypeFloat) {
+                return floats[components - 1];
+            }
+            if (scalarInfo.opcode == Op::TypeInt) {
+                return scalarInfo.operands[1] != 0 ? ints[components - 1] : uints[components - 1];
+            }
+            return VK_FORMAT_UNDEFINED;
+        }
+    };
+
+    uint32_t formatSize(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R32_SFLOAT: case VK_FORMAT_R32_SINT: case VK_FORMAT_R32_UINT: return 4;
+            case VK_FORMAT_R32G32_SFLOAT: case VK_FORMAT_R32G32_SINT: case VK_FORMAT_R32G32_UINT: return 8;
+            case VK_FORMAT_R32G32B32_SFLOAT: case VK_FORMAT_R32G32B32_SINT: case VK_FORMAT_R32G32B32_UINT: return 12;
+            case VK_FORMAT_R32G32B32A32_SFLOAT: case VK_FORMAT_R32G32B32A32_SINT: case VK_FORMAT_R32G32B32A32_UINT: return 16;
+            default: return 0;
+        }
+    }
+
+    std::optional<ShaderReflection> reflectSpirv(std::span<const uint32_t> code) {
+        if (code.size() < 5 || code[0] != spirvMagic) {
+            Logging::failure("Not a SPIR-V module.");
+            return {};
+        }
+
+        SpirvModule spirv;
+        spirv.ids.resize(code[3]);
+        ShaderReflection reflection;
+        std::vector<std::pair<uint32_t, uint32_t>> variables;
+        //Constant ids the workgroup size comes from, when it isn't given as literals.
+        std::optional<std::array<uint32_t, 3>> localSizeIds;
+        uint32_t workgroupSize = noValue;
+
+        for (size_t word = 5; word < code.size();) {
+            uint32_t wordCount = code[word] >> 16;
+            uint32_t opcode = code[word] & 0xFFFF;
+            if (wordCount == 0 || word + wordCount > code.size()) {
+                Logging::failure("Malformed SPIR-V instruction at word {}.", word);
+                return {};
+            }
+            auto operands = code.subspan(word + 1, wordCount - 1);
+            word += wordCount;
+
+            switch (opcode) {
+                case Op::EntryPoint:
+                    if (!operands.empty()) {
+                        reflection.stages |= stageFromExecutionModel(operands[0]);
+                    }
+                    break;
+                case Op::ExecutionMode:
+                    if (operands.size() >= 5 && operands[1] == executionModeLocalSize) {
+                        reflection.localSize = {operands[2], operands[3], operands[4]};
+                    }
+                    break;
+                case Op::ExecutionModeId:
+                    if (operands.size() >= 5 && operands[1] == executionModeLocalSizeId) {
+                        localSizeIds = std::array{operands[2], operands[3], operands[4]};
+                    }
+                    break;
+                case Op::Decorate: {
+                    if (operands.size() < 2) {
+                        break;
+                    }
+                    auto& target = spirv.at(operands[0]);
+                    uint32_t value = operands.size() > 2 ? operands[2] : 0;
+                    switch (operands[1]) {
+                        case Decoration::Block: target.block = true; break;
+                        case Decoration::BufferBlock: target.bufferBlock = true; break;
+                        case Decoration::ArrayStride: target.arrayStride = value; break;
+                        case Decoration::BuiltIn:
+                            target.builtIn = true;
+                            if (value == builtInWorkgroupSize) {
+                                workgroupSize = operands[0];
+                            }
+                            break;
+                        case Decoration::SpecId: target.specId = value; break;
+                        case Decoration::Location: target.location = value; break;
+                        case Decoration::Binding: target.binding = value; break;
+                        case Decoration::DescriptorSet: target.set = value; break;
+                    }
+                    break;
+                }
+                case Op::MemberDecorate: {
+                    if (operands.size() < 4) {
+                        break;
+                    }
+                    auto& target = spirv.at(operands[0]);
+                    uint32_t member = operands[1];
+                    if (operands[2] == Decoration::Offset) {
+                        target.memberOffsets.resize(std::max<size_t>(target.memberOffsets.size(), member + 1), noValue);
+                        target.memberOffsets[member] = operands[3];
+                    } else if (operands[2] == Decoration::MatrixStride) {
+                        target.memberMatrixStrides.resize(std::max<size_t>(target.memberMatrixStrides.size(), member + 1), 0);
+                        target.memberMatrixStrides[member] = operands[3];
+                    }
+                    break;
+                }
+                case Op::TypeInt: case Op::TypeFloat: case Op::TypeVector: case Op::TypeMatrix:
+                case Op::TypeImage: case Op::TypeSampler: case Op::TypeSampledImage: case Op::TypeArray:
+                case Op::TypeRuntimeArray: case Op::TypeStruct: case Op::TypePointer: case Op::TypeAccelerationStructure: {
+                    //Every operand read later must be present, the image type reads up to its sampled operand.
+                    size_t required = 1;
+                    switch (opcode) {
+                        case Op::TypeImage: required = 7; break;
+                        case Op::TypeInt: case Op::TypeVector: case Op::TypeMatrix: case Op::TypeArray: case Op::TypePointer: required = 3; break;
+                        case Op::TypeFloat: case Op::TypeSampledImage: case Op::TypeRuntimeArray: required = 2; break;
+                    }
+                    if (operands.size() < required) {
+                        Logging::failure("Malformed SPIR-V type {}.", opcode);
+                        return {};
+                    }
+                    auto& type = spirv.at(operands[0]);
+                    type.opcode = opcode;
+                    type.operands.assign(operands.begin() + 1, operands.end());
+                    break;
+                }
+                case Op::Constant: case Op::SpecConstant: {
+                    //Result type first then id, keep the type so array lengths can be read back as operands[1].
+                    if (operands.size() < 3) {
+                        break;
+                    }
+                    auto& constant = spirv.at(operands[1]);
+                    constant.opcode = opcode;
+                    constant.operands = {operands[0], operands[2]};
+                    break;
+                }
+                case Op::ConstantComposite: case Op::SpecConstantComposite: {
+                    if (operands.size() < 2) {
+                        break;
+                    }
+                    auto& composite = spirv.at(operands[1]);
+                    composite.opcode = opcode;
+                    composite.operands.assign(operands.begin() + 2, operands.end());
+                    break;
+                }
+                case Op::Variable:
+                    if (operands.size() >= 3) {
+                        variables.emplace_back(operands[1], operands[0]);
+                        spirv.at(operands[1]).operands = {operands[2]};
+                    }
+                    break;
+            }
+        }
+
+        //A WorkgroupSize built-in overrides the execution mode, and both name their constants by id. Any other
+        //source would leave localSize at {1,1,1} and over-dispatch, so it fails reflection instead.
+        if (workgroupSize != noValue) {
+            auto& composite = spirv.at(workgroupSize);
+            if ((composite.opcode != Op::ConstantComposite && composite.opcode != Op::SpecConstantComposite) || composite.operands.size() != 3) {
+                Logging::failure("The WorkgroupSize built-in isn't a three component constant.");
+                return {};
+            }
+            localSizeIds = std::array{composite.operands[0], composite.operands[1], composite.operands[2]};
+        }
+        if (localSizeIds) {
+            for (size_t axis = 0; axis < 3; axis++) {
+                auto& constant = spirv.at(localSizeIds.value()[axis]);
+                if (constant.opcode != Op::Constant && constant.opcode != Op::SpecConstant) {
+                    Logging::failure("Workgroup size {} isn't a scalar constant.", axis);
+                    return {};
+                }
+                reflection.localSize[axis] = constant.operands[1];
+                reflection.localSizeConstantIds[axis] = constant.opcode == Op::SpecConstant ? constant.specId : noValue;
+            }
+        }
+
+        //Decorations can come before the types they decorate, so variables are only resolved once everything is read.
+        std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+        std::optional<VkPushConstantRange> pushConstant;
+
+        for (auto [id, pointerType] : variables) {
+            auto& variable = spirv.at(id);
+            uint32_t storageClass = variable.operands[0];
+            uint32_t count;
+            uint32_t type = spirv.elementType(pointerType, count);
+
+            if (storageClass == StorageClass::PushConstant) {
+                uint32_t size = spirv.typeSize(type);
+                auto& offsets = spirv.at(type).memberOffsets;
+                uint32_t offset = offsets.empty() || offsets[0] == noValue ? 0 : std::ranges::min(offsets);
+                pushConstant = VkPushConstantRange{reflection.stages, offset, size - offset};
+                continue;
+            }
+
+            if (storageClass == StorageClass::Input) {
+                if (variable.builtIn || spirv.at(type).builtIn || variable.location == noValue || !(reflection.stages & VK_SHADER_STAGE_VERTEX_BIT)) {
+                    continue;
+                }
+                VkFormat format = spirv.vertexFormat(type);
+                if (format == VK_FORMAT_UNDEFINED) {
+                    Logging::warning("Vertex input at location {} has a type reflection doesn't handle.", variable.location);
+                    continue;
+                }
+                reflection.vertexInputs.push_back({variable.location, format});
+                continue;
+            }
+
+            auto descriptorType = spirv.descriptorType(storageClass, type);
+            if (!descriptorType) {
+                continue;
+            }
+            if (variable.binding == noValue) {
+                Logging::warning("Shader resource {} has no binding decoration, skipping it.", id);
+                continue;
+            }
+
+            VkDescriptorSetLayoutBinding binding{};
+            binding.binding = variable.binding;
+            binding.descriptorType = descriptorType.value();
+            binding.descriptorCount = count;
+            binding.stageFlags = reflection.stages;
+            sets[variable.set == noValue ? 0 : variable.set][variable.binding] = binding;
+        }
+
+        for (auto& [set, bindings] : sets) {
+            auto& setReflection = reflection.sets.emplace_back(set);
+            for (auto& [index, binding] : bindings) {
+                setReflection.bindings.push_back(binding);
+            }
+        }
+        if (pushConstant) {
+            reflection.pushConstants.push_back(pushConstant.value());
+        }
+        std::ranges::sort(reflection.vertexInputs, {}, &VertexInputReflection::location);
+        return reflection;
+    }
+
+    bool ShaderReflection::merge(const ShaderReflection& other) {
+        bool compatible = true;
+        stages |= other.stages;
+
+        for (const auto& otherSet : other.sets) {
+            auto set = std::ranges::lower_bound(sets, otherSet.set, {}, &DescriptorSetReflection::set);
+            if (set == sets.end() || set->set != otherSet.set) {
+                sets.insert(set, otherSet);
+                continue;
+            }
+            for (const auto& otherBinding : otherSet.bindings) {
+                auto binding = std::ranges::lower_bound(set->bindings, otherBinding.binding, {}, &VkDescriptorSetLayoutBinding::binding);
+                if (binding == set->bindings.end() || binding->binding != otherBinding.binding) {
+                    set->bindings.insert(binding, otherBinding);
+                } else if (binding->descriptorType != otherBinding.descriptorType || binding->descriptorCount != otherBinding.descriptorCount) {
+                    Logging::failure("Shader stages disagree on set {} binding {}.", otherSet.set, otherBinding.binding);
+                    compatible = false;
+                } else {
+                    binding->stageFlags |= otherBinding.stageFlags;
+                }
+            }
+        }
+
+        //One range covering every stage's push constants is always valid, and keeps vkCmdPushConstants to one call.
+        for (const auto& range : other.pushConstants) {
+            if (pushConstants.empty()) {
+                pushConstants.push_back(range);
+                continue;
+            }
+            auto& merged = pushConstants.front();
+            uint32_t end = std::max(merged.offset + merged.size, range.offset + range.size);
+            merged.offset = std::min(merged.offset, range.offset);
+            merged.size = end - merged.offset;
+            merged.stageFlags |= range.stageFlags;
+        }
+
+        if (vertexInputs.empty()) {
+            vertexInputs = other.vertexInputs;
+        }
+        if (other.stages & VK_SHADER_STAGE_COMPUTE_BIT) {
+            localSize = other.localSize;
+            localSizeConstantIds = other.localSizeConstantIds;
+        }
+        return compatible;
+    }
+
+    VertexLayout ShaderReflection::vertexLayout(uint32_t binding) const {
+        VertexLayout layout;
+        uint32_t offset = 0;
+        for (const auto& input : vertexInputs) {
+            layout.attributes.push_back({input.location, binding, input.format, offset});
+            offset += formatSize(input.format);
+        }
+        if (!vertexInputs.empty()) {
+            layout.bindings.push_back({binding, offset, VK_VERTEX_INPUT_RATE_VERTEX});
+        }
+        return layout;
+    }
+
+    enum class NumericType { Float, Signed, Unsigned, Unknown };
+
+    //UNORM, SNORM and half formats read as floats in the shader, so only the numeric type has to agree.
+    NumericType numericType(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R32_SFLOAT: case VK_FORMAT_R32G32_SFLOAT: case VK_FORMAT_R32G32B32_SFLOAT: case VK_FORMAT_R32G32B32A32_SFLOAT:
+            case VK_FORMAT_R16_SFLOAT: case VK_FORMAT_R16G16_SFLOAT: case VK_FORMAT_R16G16B16A16_SFLOAT:
+            case VK_FORMAT_R16_UNORM: case VK_FORMAT_R16G16_UNORM: case VK_FORMAT_R16G16B16A16_UNORM:
+            case VK_FORMAT_R16_SNORM: case VK_FORMAT_R16G16_SNORM: case VK_FORMAT_R16G16B16A16_SNORM:
+            case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_R8_SNORM: case VK_FORMAT_R8G8_SNORM: case VK_FORMAT_R8G8B8A8_SNORM:
+            case VK_FORMAT_A2B10G10R10_UNORM_PACK32: case VK_FORMAT_A2B10G10R10_SNORM_PACK32:
+                return NumericType::Float;
+            case VK_FORMAT_R32_SINT: case VK_FORMAT_R32G32_SINT: case VK_FORMAT_R32G32B32_SINT: case VK_FORMAT_R32G32B32A32_SINT:
+            case VK_FORMAT_R16_SINT: case VK_FORMAT_R16G16_SINT: case VK_FORMAT_R16G16B16A16_SINT:
+            case VK_FORMAT_R8_SINT: case VK_FORMAT_R8G8_SINT: case VK_FORMAT_R8G8B8A8_SINT:
+                return NumericType::Signed;
+            case VK_FORMAT_R32_UINT: case VK_FORMAT_R32G32_UINT: case VK_FORMAT_R32G32B32_UINT: case VK_FORMAT_R32G32B32A32_UINT:
+            case VK_FORMAT_R16_UINT: case VK_FORMAT_R16G16_UINT: case VK_FORMAT_R16G16B16A16_UINT:
+            case VK_FORMAT_R8_UINT: case VK_FORMAT_R8G8_UINT: case VK_FORMAT_R8G8B8A8_UINT:
+                return NumericType::Unsigned;
+            default:
+                return NumericType::Unknown;
+        }
+    }
+
+    bool compatibleVertexFormats(VkFormat attribute, VkFormat input) {
+        if (attribute == input) {
+            return true;
+        }
+        //Missing components are filled in from (0, 0, 0, 1) and extra ones ignored, so the component count can differ.
+        auto type = numericType(attribute);
+        return type != NumericType::Unknown && type == numericType(input);
+    }
+
+    bool ShaderReflection::matches(const VertexLayout& layout) const {
+        bool matching = true;
+        for (const auto& input : vertexInputs) {
+            auto attribute = std::ranges::find(layout.attributes, input.location, &VkVertexInputAttributeDescription::location);
+            if (attribute == layout.attributes.end()) {
+                Logging::failure("Vertex layout has no attribute for shader input location {}.", input.location);
+                matching = false;
+            } else if (!compatibleVertexFormats(attribute->format, input.format)) {
+                Logging::failure("Vertex layout feeds location {} with format {}, the shader expects {}.",
+                    input.location, static_cast<int>(attribute->format), static_cast<int>(input.format));
+                matching = false;
+            }
+        }
+        return matching;
+    }
+
+    ShaderReflectionCache::Key bindingsKey(std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorSetLayoutCreateFlags flags) {
+        ShaderReflectionCache::Key key;
+        key.words.reserve(1 + bindings.size() * 4);
+        key.words.push_back(flags);
+        for (const auto& binding : bindings) {
+            key.words.insert(key.words.end(), {binding.binding, static_cast<uint64_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags});
+        }
+        return key;
+    }
+
+    const ShaderReflection* ShaderReflectionCache::reflect(std::span<const uint32_t> code) {
+        Key key{std::vector<uint64_t>(code.begin(), code.end())};
+
+        std::lock_guard lock(mutex);
+        if (auto found = shaders.find(key); found != shaders.end()) {
+            return &found->second;
+        }
+        auto reflection = reflectSpirv(code);
+        if (!reflection) {
+            return nullptr;
+        }
+        return &shaders.emplace(std::move(key), std::move(reflection.value())).first->second;
+    }
+
+    std::optional<ShaderReflection> ShaderReflectionCache::reflectFiles(std::initializer_list<std::filesystem::path> paths, bool preferDisk) {
+        ShaderReflection merged;
+        for (const auto& path : paths) {
+            auto code = Shaders::loadSpirv(path, preferDisk);
+            if (!code) {
+                Logging::failure("Couldn't read {} for reflection.", path.string());
+                return {};
+            }
+            auto* reflection = reflect(code->words);
+            if (reflection == nullptr || !merged.merge(*reflection)) {
+                Logging::failure("Couldn't reflect {}.", path.string());
+                return {};
+            }
+        }
+        return merged;
+    }
+
+    VkDescriptorSetLayout createSetLayout(VkDevice logicalDevice, std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorSetLayoutCreateFlags flags) {
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.flags = flags;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+            Logging::failure("Couldn't create a reflected descriptor set layout.");
+            return VK_NULL_HANDLE;
+        }
+        return setLayout;
+    }
+
+    void ShaderReflectionCache::useSetLayout(uint32_t set, VkDescriptorSetLayout layout) {
+        std::lock_guard lock(mutex);
+        externalSetLayouts[set] = layout;
+    }
+
+    void ShaderReflectionCache::usePushDescriptors(uint32_t set) {
+        std::lock_guard lock(mutex);
+        pushDescriptorSets.insert(set);
+    }
+
+    std::vector<VkDescriptorSetLayout> ShaderReflectionCache::descriptorSetLayouts(VkDevice logicalDevice, const ShaderReflection& reflection) {
+        uint32_t setCount = reflection.sets.empty() ? 0 : reflection.sets.back().set + 1;
+        std::vector<VkDescriptorSetLayout> layouts(setCount, VK_NULL_HANDLE);
+
+        std::lock_guard lock(mutex);
+        for (uint32_t set = 0; set < setCount; set++) {
+            if (auto external = externalSetLayouts.find(set); external != externalSetLayouts.end()) {
+                layouts[set] = external->second;
+                continue;
+            }
+
+            auto reflected = std::ranges::find(reflection.sets, set, &DescriptorSetReflection::set);
+            std::span<const VkDescriptorSetLayoutBinding> bindings;
+            if (reflected != reflection.sets.end()) {
+                bindings = reflected->bindings;
+            }
+
+            VkDescriptorSetLayoutCreateFlags flags = setLayoutFlags;
+            if (pushDescriptorSets.contains(set)) {
+                flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+            }
+            auto key = bindingsKey(bindings, flags);
+            if (auto found = setLayouts.find(key); found != setLayouts.end()) {
+                layouts[set] = found->second;
+                continue;
+            }
+            //A failed layout isn't cached, so the next pipeline asking for it tries again.
+            layouts[set] = createSetLayout(logicalDevice, bindings, flags);
+            if (layouts[set] != VK_NULL_HANDLE) {
+                setLayouts.emplace(std::move(key), layouts[set]);
+            }
+        }
+        return layouts;
+    }
+
+    VkPipelineLayout ShaderReflectionCache::pipelineLayout(VkDevice logicalDevice, const ShaderReflection& reflection) {
+        auto layouts = descriptorSetLayouts(logicalDevice, reflection);
+        if (std::ranges::contains(layouts, VK_NULL_HANDLE)) {
+            return VK_NULL_HANDLE;
+        }
+
+        Key key;
+        key.words.push_back(layouts.size());
+        for (auto layout : layouts) {
+            key.words.push_back(reinterpret_cast<uint64_t>(layout));
+        }
+        for (const auto& range : reflection.pushConstants) {
+            key.words.insert(key.words.end(), {range.stageFlags, range.offset, range.size});
+        }
+
+        std::lock_guard lock(mutex);
+        if (auto found = pipelineLayouts.find(key); found != pipelineLayouts.end()) {
+            return found->second;
+        }
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(layouts.size());
+        pipelineLayoutInfo.pSetLayouts = layouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(reflection.pushConstants.size());
+        pipelineLayoutInfo.pPushConstantRanges = reflection.pushConstants.data();
+
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+            Logging::failure("Couldn't create a reflected pipeline layout.");
+            return VK_NULL_HANDLE;
+        }
+        pipelineLayouts.emplace(std::move(key), pipelineLayout);
+        return pipelineLayout;
+    }
+
+    void ShaderReflectionCache::destroy(VkDevice logicalDevice) {
+        for (auto& [key, layout] : pipelineLayouts) {
+            vkDestroyPipelineLayout(logicalDevice, layout, nullptr);
+        }
+        for (auto& [key, layout] : setLayouts) {
+            if (layout != VK_NULL_HANDLE) {
+                vkDestroyDescriptorSetLayout(logicalDevice, layout, nullptr);
+            }
+        }
+        pipelineLayouts.clear();
+        setLayouts.clear();
+        externalSetLayouts.clear();
+        pushDescriptorSets.clear();
+        shaders.clear();
+    }
+}
@@ -7,7 +7,8 @@ export module Surface;
 export namespace Vulkan {
 
     VkSurfaceKHR createSurface(VkInstance instance, GLFWwindow* window);
-    
+    VkSurfaceKHR createHeadlessSurface(VkInstance instance);
+
 }
 
 namespace Vulkan {
@@ -16,4 +17,19 @@ namespace Vulkan {
         glfwCreateWindowSurface(instance, window, nullptr, &surface);
         return surface;
     }
+
+    //VK_EXT_headless_surface, a presentable surface with no window behind it.
+    VkSurfaceKHR createHeadlessSurface(VkInstance instance) {
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
+        auto createHeadlessSurfaceEXT = reinterpret_cast<PFN_vkCreateHeadlessSurfaceEXT>(
+            vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT"));
+        if (createHeadlessSurfaceEXT == nullptr) {
+            return VK_NULL_HANDLE;
+        }
+
+        VkHeadlessSurfaceCreateInfoEXT createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+        createHeadlessSurfaceEXT(instance, &createInfo, nullptr, &surface);
+        return surface;
+    }
 }
\ No newline at end of file
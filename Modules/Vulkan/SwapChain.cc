@@ -6,6 +6,7 @@ export module SwapChain;
 
 import std;
 import Queues;
+import Logging;
 
 namespace Vulkan {
 
@@ -48,22 +49,77 @@ namespace Vulkan {
         return availableFormats[0];
     }
 
-    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-        for (const auto& availablePresentMode : availablePresentModes) {
-            if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                return availablePresentMode;
+    export enum class PresentPolicy {
+        Immediate,   //Uncapped and may tear, for benchmarking throughput.
+        Mailbox,     //Tear free, newest frame replaces the queued one, low latency.
+        Fifo,        //Tear free vsync, always supported.
+        FifoRelaxed  //Vsync, but late frames are shown immediately and may tear.
+    };
+
+    export struct SwapChainPolicy {
+        PresentPolicy presentMode = PresentPolicy::Mailbox;
+        //Explicit number of swapchain images, 0 keeps the minImageCount + 1 default. Clamped to what the surface allows.
+        uint32_t imageCount = 0;
+    };
+
+    export const char* presentModeName(VkPresentModeKHR presentMode) {
+        switch (presentMode) {
+            case VK_PRESENT_MODE_IMMEDIATE_KHR: return "Immediate";
+            case VK_PRESENT_MODE_MAILBOX_KHR: return "Mailbox";
+            case VK_PRESENT_MODE_FIFO_KHR: return "Fifo";
+            case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FifoRelaxed";
+            default: return "Unknown";
+        }
+    }
+
+    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, PresentPolicy policy) {
+        //Each policy falls back to the closest mode with the same intent, ending in FIFO which is always available.
+        std::vector<VkPresentModeKHR> preferred;
+        switch (policy) {
+            case PresentPolicy::Immediate:
+                preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+                break;
+            case PresentPolicy::Mailbox:
+                preferred = {VK_PRESENT_MODE_MAILBOX_KHR};
+                break;
+            case PresentPolicy::FifoRelaxed:
+                preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+                break;
+            case PresentPolicy::Fifo:
+                break;
+        }
+
+        for (const auto& preferredPresentMode : preferred) {
+            if (std::ranges::find(availablePresentModes, preferredPresentMode) != availablePresentModes.end()) {
+                return preferredPresentMode;
             }
         }
 
+        if (!preferred.empty()) {
+            Logging::warning("Requested present mode {} is unavailable, falling back to Fifo.", presentModeName(preferred.front()));
+        }
         return VK_PRESENT_MODE_FIFO_KHR;
     }
 
-    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* window) {
+    uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t requestedImageCount) {
+        uint32_t imageCount = requestedImageCount == 0 ? capabilities.minImageCount + 1 : requestedImageCount;
+        imageCount = std::max(imageCount, capabilities.minImageCount);
+
+        //It should be noted that "0" in this case means no limit not zero supported, so min is not going to work here for that reason.
+        if (capabilities.maxImageCount > 0 && imageCount >= capabilities.maxImageCount) {
+            imageCount = capabilities.maxImageCount;
+        }
+        return imageCount;
+    }
+
+    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* window, VkExtent2D headlessExtent) {
         if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
             return capabilities.currentExtent;
         } else {
-            int width, height;
-            glfwGetFramebufferSize(window, &width, &height);
+            int width = static_cast<int>(headlessExtent.width), height = static_cast<int>(headlessExtent.height);
+            if (window != nullptr) {
+                glfwGetFramebufferSize(window, &width, &height);
+            }
 
             VkExtent2D actualExtent = {
                 static_cast<uint32_t>(width),
@@ -77,17 +133,59 @@ namespace Vulkan {
         }
     }
 
+    //A swapchain replaced by a rebuild. It stays alive until every frame that rendered into it has retired.
+    export struct RetiredSwapChain {
+        VkSwapchainKHR vulkanSwapChain;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkFramebuffer> framebuffers;
+        std::vector<VkFence> pendingFrames;
+
+        void destroy(VkDevice logicalDevice) {
+            for (auto& framebuffer : framebuffers) {
+                vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+            }
+            for (auto& imageView : imageViews) {
+                vkDestroyImageView(logicalDevice, imageView, nullptr);
+            }
+            vkDestroySwapchainKHR(logicalDevice, vulkanSwapChain, nullptr);
+        }
+    };
+
     export struct RenderingSwapChain {
         VkSwapchainKHR vulkanSwapChain;
         VkExtent2D extent;
         VkFormat format;
         VkSurfaceKHR surface;
+        //Null when running headless, the extent then comes from headlessExtent.
         GLFWwindow* window;
+        VkExtent2D headlessExtent{800, 600};
         std::vector<VkImage> images;
         std::vector<VkImageView> imageViews;
         std::vector<VkFramebuffer> framebuffers;
+        //In flight fences of every frame that has rendered into the current swapchain.
+        std::vector<VkFence> framesInFlight;
+        std::vector<RetiredSwapChain> retired;
+
+        SwapChainPolicy policy;
+        VkPresentModeKHR presentMode;
+        //Requested image usage, build drops anything the surface doesn't support. IE TRANSFER_SRC for frame readback.
+        VkImageUsageFlags imageUsage{VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+        //Set when the policy changes, drawFrame rebuilds at the next present.
+        bool rebuildRequested{false};
+
+        void setPolicy(SwapChainPolicy newPolicy) {
+            if (newPolicy.presentMode == policy.presentMode && newPolicy.imageCount == policy.imageCount) {
+                return;
+            }
+            policy = newPolicy;
+            rebuildRequested = true;
+        }
 
         void destroy(VkDevice logicalDevice) {
+            for (auto& old : retired) {
+                old.destroy(logicalDevice);
+            }
+            retired.clear();
             for (auto& framebuffer : framebuffers) {
                 vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
             }
@@ -145,23 +243,19 @@ namespace Vulkan {
             VkPhysicalDevice physicalDevice, 
             VkDevice logicalDevice,
             VkSurfaceKHR vulkanSurface, 
-            GLFWwindow* glfwWindow
+            GLFWwindow* glfwWindow,
+            VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE
             ) {
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, vulkanSurface);
-            VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+            presentMode = chooseSwapPresentMode(swapChainSupport.presentModes, policy.presentMode);
             VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 
             surface = vulkanSurface;
             window = glfwWindow;
             format = surfaceFormat.format;
-            extent = chooseSwapExtent(swapChainSupport.capabilities, glfwWindow);
-
-            uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+            extent = chooseSwapExtent(swapChainSupport.capabilities, glfwWindow, headlessExtent);
 
-            //It should be noted that "0" in this case means no limit not zero supported, so min is not going to work here for that reason.
-            if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount >= swapChainSupport.capabilities.maxImageCount) {
-                imageCount = swapChainSupport.capabilities.maxImageCount;
-            }
+            uint32_t imageCount = chooseSwapImageCount(swapChainSupport.capabilities, policy.imageCount);
 
             VkSwapchainCreateInfoKHR createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -171,7 +265,12 @@ namespace Vulkan {
             createInfo.imageColorSpace = surfaceFormat.colorSpace;
             createInfo.imageExtent = extent;
             createInfo.imageArrayLayers = 1;
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            VkImageUsageFlags unsupportedUsage = imageUsage & ~swapChainSupport.capabilities.supportedUsageFlags;
+            if (unsupportedUsage != 0) {
+                Logging::warning("Surface doesn't support swapchain image usage {:#x}, dropping it.", unsupportedUsage);
+                imageUsage &= ~unsupportedUsage;
+            }
+            createInfo.imageUsage = imageUsage | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
             QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
             createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -181,13 +280,19 @@ namespace Vulkan {
 
             createInfo.presentMode = presentMode;
             createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
+            //Handing over the old swapchain lets the driver reuse its resources and keep presenting while we switch.
+            createInfo.oldSwapchain = oldSwapChain;
 
-            vkCreateSwapchainKHR(logicalDevice, &createInfo, nullptr, &vulkanSwapChain);
+            if (vkCreateSwapchainKHR(logicalDevice, &createInfo, nullptr, &vulkanSwapChain) != VK_SUCCESS) {
+                vulkanSwapChain = VK_NULL_HANDLE;
+                return;
+            }
 
             vkGetSwapchainImagesKHR(logicalDevice, vulkanSwapChain, &imageCount, nullptr);
             images.resize(imageCount);
             vkGetSwapchainImagesKHR(logicalDevice, vulkanSwapChain, &imageCount, images.data());
+            rebuildRequested = false;
+            Logging::info("Swapchain built with present mode {} and {} images.", presentModeName(presentMode), imageCount);
 
             populateImageViews(logicalDevice);
         }
@@ -212,17 +317,49 @@ namespace Vulkan {
         void rebuild(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkRenderPass renderPass) {
             //Pause minimized window
             int width = 0, height = 0;
-            glfwGetFramebufferSize(window, &width, &height);
-            while (width == 0 || height == 0) {
+            while (window != nullptr && (width == 0 || height == 0)) {
                 glfwGetFramebufferSize(window, &width, &height);
-                glfwWaitEvents();
+                if (width == 0 || height == 0) {
+                    glfwWaitEvents();
+                }
             }
-            vkDeviceWaitIdle(logicalDevice);
 
-            destroy(logicalDevice);
+            //No device wait here, the old swapchain and its views/framebuffers are retired instead and
+            //released by releaseRetired once the frames still using them have finished.
+            RetiredSwapChain old{vulkanSwapChain, std::move(imageViews), std::move(framebuffers), std::move(framesInFlight)};
+            imageViews.clear();
+            framebuffers.clear();
+            framesInFlight.clear();
 
-            build(physicalDevice, logicalDevice, surface, window);
+            build(physicalDevice, logicalDevice, surface, window, old.vulkanSwapChain);
             populateFramebuffers(logicalDevice, renderPass);
+
+            if (old.pendingFrames.empty()) {
+                old.destroy(logicalDevice);
+            } else {
+                retired.push_back(std::move(old));
+            }
+        }
+
+        //Records that the frame guarded by this fence rendered into the current swapchain.
+        void trackFrame(VkFence inFlightFence) {
+            if (std::ranges::find(framesInFlight, inFlightFence) == framesInFlight.end()) {
+                framesInFlight.push_back(inFlightFence);
+            }
+        }
+
+        //Destroys retired swapchains whose frames have all signaled. Never blocks.
+        void releaseRetired(VkDevice logicalDevice) {
+            std::erase_if(retired, [logicalDevice](RetiredSwapChain& old) {
+                std::erase_if(old.pendingFrames, [logicalDevice](VkFence fence) {
+                    return vkGetFenceStatus(logicalDevice, fence) == VK_SUCCESS;
+                });
+                if (!old.pendingFrames.empty()) {
+                    return false;
+                }
+                old.destroy(logicalDevice);
+                return true;
+            });
         }
     };
 }
\ No newline at end of file
@@ -3,40 +3,1072 @@ module;
 #include <GLFW/glfw3.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 export module Textures;
 
 import std;
+import Logging;
 import Buffers;
+import Queues;
+import Descriptors;
+import PipelineCache;
+import ShaderReflection;
+import ComputePipeline;
+import DescriptorTemplates;
+
+/*
+    Loads textures from disk without blocking the render loop.
+
+    load() only queues the path and returns a handle. A pool of worker threads decodes the files with stb_image,
+    which is where nearly all the time goes, so a few hundred textures keep every core busy. The render thread
+    calls update() once per frame. It packs whatever has finished decoding into one staging buffer and records one
+    command buffer: a barrier for all the new images, the copies, and a barrier back to SHADER_READ_ONLY. The
+    submit is fenced rather than waited on, and a texture's status turns Ready once a later update() sees the
+    fence signalled. Poll status() or get() per frame like PipelineCompiler handles, or call waitIdle() at the end
+    of a loading screen.
+
+    .ktx2 files skip decoding entirely. The worker memory maps the file, checks the header and level index, and the
+    level data (BC1-BC7, ASTC, RGBA8 or RGBA16F/32F, every pre-baked mip) is copied straight from the mapping into
+    staging. Only uncompressed files without supercompression are read, Basis Universal and zstd payloads are
+    rejected. Radiance .hdr files decode to RGBA32F.
+
+    Mip chains are generated on the GPU in the same command buffer, level by level across every texture in the
+    batch, so each level costs one barrier call however many textures there are. Formats that can be blitted with
+    linear filtering use a vkCmdBlitImage chain. RGBA8 and RGBA16F always can; RGBA32F is only required to support
+    blits, not linear filtering, so where it can't be filtered but can be a storage image it falls back to the
+    downsample compute shader when enableComputeMipmaps was called. Anything else keeps a single level, and
+    textures whose format can't be filtered get a nearest sampler.
+*/
+
+export namespace Vulkan {
+
+    enum class TextureStatus { Pending, Ready, Failed };
+
+    enum class MipGeneration { None, Blit, Compute };
+
+    //The block compression features the device has, to pass to createLogicalDevice. KTX2 textures in a format the
+    //device can't sample fail to load.
+    VkPhysicalDeviceFeatures textureCompressionFeatures(VkPhysicalDevice physicalDevice);
+
+    struct Texture {
+        std::filesystem::path path;
+        VkFormat format{VK_FORMAT_R8G8B8A8_SRGB};
+        VkExtent2D extent{0, 0};
+        //Set when decoded, the full chain down to 1x1 unless generateMipmaps is off.
+        uint32_t mipLevels{1};
+        bool generateMipmaps{true};
+
+        VkImage image{VK_NULL_HANDLE};
+        VkDeviceMemory memory{VK_NULL_HANDLE};
+        VkImageView view{VK_NULL_HANDLE};
+        //Shared by every texture from the same loader, linear or nearest depending on what the format supports.
+        VkSampler sampler{VK_NULL_HANDLE};
+
+        std::atomic<TextureStatus> status{TextureStatus::Pending};
+    };
+
+    //Points at the loader's stable storage, so polling it needs no lock.
+    struct TextureHandle {
+        const Texture* texture{nullptr};
+
+        bool valid() const {
+            return texture != nullptr;
+        }
+    };
+
+    struct TextureLoader {
+        //Texel data waiting for an upload batch, one span per level present in the file.
+        struct DecodedTexture {
+            Texture* texture;
+            //Keeps the levels alive, decoded pixels or a mapped KTX2 file.
+            std::shared_ptr<const void> source;
+            std::vector<std::span<const std::byte>> levels;
+            VkDeviceSize size{0};
+            MipGeneration mipmaps{MipGeneration::None};
+        };
+
+        //A submitted batch, retired once its fence signals.
+        struct UploadBatch {
+            VkFence fence{VK_NULL_HANDLE};
+            VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+            VkBuffer staging{VK_NULL_HANDLE};
+            VkDeviceMemory stagingMemory{VK_NULL_HANDLE};
+            std::vector<Texture*> textures;
+            //Per level views and sets of compute generated mips.
+            std::vector<VkImageView> levelViews;
+            Descriptors::DescriptorAllocator descriptors;
+        };
+
+        VkPhysicalDevice physicalDevice{VK_NULL_HANDLE};
+        VkDevice logicalDevice{VK_NULL_HANDLE};
+        VkQueue queue{VK_NULL_HANDLE};
+        VkCommandPool commandPool{VK_NULL_HANDLE};
+        VkSampler sampler{VK_NULL_HANDLE};
+        VkSampler nearestSampler{VK_NULL_HANDLE};
+        //Most staging memory one update() uploads, a larger texture still goes on its own.
+        VkDeviceSize uploadBudget{64 * 1024 * 1024};
+
+        //Compute mip fallback, see enableComputeMipmaps.
+        ComputePipeline downsample;
+        VkSampler downsampleSampler{VK_NULL_HANDLE};
+        //Set when the reflection cache makes set 0 a push descriptor set, the levels are then pushed instead of allocated.
+        const PushDescriptorFunctions* pushDescriptors{nullptr};
+        //Render thread only, see features().
+        std::unordered_map<VkFormat, VkFormatFeatureFlags> formatFeatures;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable jobsChanged;
+        std::deque<Texture*> jobs;
+        uint32_t jobsInProgress{0};
+        bool stopping{false};
+
+        //Deque so textures never move while workers and handles point at them. Guarded by mutex.
+        std::deque<Texture> textures;
+        std::vector<DecodedTexture> decoded;
+        //Render thread only.
+        std::vector<UploadBatch> uploads;
+
+        //queue has to be from the graphics family, update() submits to it. 0 workers picks one less than the
+        //hardware thread count, leaving a core for the render loop.
+        bool start(VkPhysicalDevice physical, VkDevice device, VkQueue uploadQueue, uint32_t workerCount = 0);
+        void stop();
+        //Stops the workers, waits for uploads in flight and destroys every texture. Nothing may still be sampling them.
+        void destroy();
+        //Joins the decode workers. Images and uploads still in flight need the device, so they're left to destroy().
+        ~TextureLoader();
+
+        //Render thread, before the first update(). Builds the downsample shader for formats without linear blits.
+        //Not available with descriptor buffers, whose set layouts can't be allocated from pools. When reflections
+        //pushes set 0, pushDescriptorFunctions has to be given.
+        bool enableComputeMipmaps(ShaderReflectionCache& reflections, const PipelineCache& pipelineCache, bool preferDiskShaders = false,
+            const PushDescriptorFunctions* pushDescriptorFunctions = nullptr);
+
+        //Thread safe. srgb for color data, UNORM for normal maps and other linear data. KTX2 files carry their own
+        //format and mips, srgb is ignored for them and generateMipmaps only applies when the file has no levels.
+        //HDR files are linear RGBA32F, srgb is ignored for them too.
+        TextureHandle load(const std::filesystem::path& path, bool srgb = true, bool generateMipmaps = true);
+
+        //Never blocks. Null until the texture is ready.
+        const Texture* get(TextureHandle handle) const;
+        TextureStatus status(TextureHandle handle) const;
+
+        //Render thread, once per frame. Retires finished uploads and submits the next batch.
+        void update();
+        //Render thread. True while anything is still decoding or uploading.
+        bool busy();
+        //Render thread. Blocks until every queued texture is ready or failed.
+        void waitIdle();
+
+        //Render thread. How the texture's mip chain gets made, None when it has one level or nothing can make it.
+        MipGeneration mipGeneration(const Texture& texture);
+        //Render thread. The format's optimal tiling features, cached.
+        VkFormatFeatureFlags features(VkFormat format);
+    };
+
+}
 
 namespace Vulkan {
-    void createTextureImage(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::filesystem::path& texturePath) {
-        int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(
-            texturePath.string().c_str(), 
-            &texWidth, 
-            &texHeight, 
-            &texChannels, 
-            STBI_rgb_alpha);
-        //Not doing width*height*channels so that all images always are loaded with an alpha channel even if the og had none.
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-
-        std::tie(stagingBuffer, stagingBufferMemory) = createBuffer(physicalDevice, logicalDevice, imageSize, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
+    //Copy offsets have to be a multiple of the texel or block size.
+    constexpr VkDeviceSize stagingAlignment = 16;
+
+    //Checked before the image is created, vkCreateImage doesn't have to fail cleanly for sizes past the limit.
+    bool fitsDevice(VkPhysicalDevice physicalDevice, const Texture& texture, uint32_t width, uint32_t height) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        uint32_t limit = properties.limits.maxImageDimension2D;
+        if (width > limit || height > limit) {
+            Logging::failure("Texture {} is {}x{}, this device's 2D images are at most {}x{}.", texture.path.string(), width, height, limit, limit);
+            return false;
+        }
+        return true;
+    }
+
+    std::optional<TextureLoader::DecodedTexture> decodeImage(VkPhysicalDevice physicalDevice, Texture& texture) {
+        int width, height, channels;
+        //Always 4 channels, 3 channel formats are rarely sampleable. HDR files keep their range as 32 bit floats.
+        bool hdr = stbi_is_hdr(texture.path.string().c_str());
+        void* pixels = hdr ?
+            static_cast<void*>(stbi_loadf(texture.path.string().c_str(), &width, &height, &channels, STBI_rgb_alpha)) :
+            static_cast<void*>(stbi_load(texture.path.string().c_str(), &width, &height, &channels, STBI_rgb_alpha));
+        if (pixels == nullptr) {
+            Logging::failure("Couldn't decode texture {}: {}", texture.path.string(), stbi_failure_reason());
+            return {};
+        }
+
+        if (!fitsDevice(physicalDevice, texture, static_cast<uint32_t>(width), static_cast<uint32_t>(height))) {
+            stbi_image_free(pixels);
+            return {};
+        }
+
+        if (hdr) {
+            texture.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        }
+        texture.extent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+        texture.mipLevels = texture.generateMipmaps ? std::bit_width(std::max(texture.extent.width, texture.extent.height)) : 1;
+        TextureLoader::DecodedTexture result{&texture};
+        result.size = static_cast<VkDeviceSize>(width) * height * 4 * (hdr ? sizeof(float) : 1);
+        result.source = std::shared_ptr<const void>(pixels, stbi_image_free);
+        result.levels.push_back({reinterpret_cast<const std::byte*>(pixels), static_cast<size_t>(result.size)});
+        return result;
+    }
+
+    //Texel block dimensions and bytes per block, 1x1 for uncompressed formats. Zero bytes for formats KTX2 files
+    //aren't read in.
+    struct TexelBlock {
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes;
+    };
+
+    TexelBlock texelBlock(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB:
+                return {1, 1, 4};
+            case VK_FORMAT_R16G16B16A16_SFLOAT:
+                return {1, 1, 8};
+            case VK_FORMAT_R32G32B32A32_SFLOAT:
+                return {1, 1, 16};
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            case VK_FORMAT_BC4_UNORM_BLOCK: case VK_FORMAT_BC4_SNORM_BLOCK:
+                return {4, 4, 8};
+            case VK_FORMAT_BC2_UNORM_BLOCK: case VK_FORMAT_BC2_SRGB_BLOCK:
+            case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC5_UNORM_BLOCK: case VK_FORMAT_BC5_SNORM_BLOCK:
+            case VK_FORMAT_BC6H_UFLOAT_BLOCK: case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+            case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK:
+                return {4, 4, 16};
+            case VK_FORMAT_ASTC_4x4_UNORM_BLOCK: case VK_FORMAT_ASTC_4x4_SRGB_BLOCK: return {4, 4, 16};
+            case VK_FORMAT_ASTC_5x4_UNORM_BLOCK: case VK_FORMAT_ASTC_5x4_SRGB_BLOCK: return {5, 4, 16};
+            case VK_FORMAT_ASTC_5x5_UNORM_BLOCK: case VK_FORMAT_ASTC_5x5_SRGB_BLOCK: return {5, 5, 16};
+            case VK_FORMAT_ASTC_6x5_UNORM_BLOCK: case VK_FORMAT_ASTC_6x5_SRGB_BLOCK: return {6, 5, 16};
+            case VK_FORMAT_ASTC_6x6_UNORM_BLOCK: case VK_FORMAT_ASTC_6x6_SRGB_BLOCK: return {6, 6, 16};
+            case VK_FORMAT_ASTC_8x5_UNORM_BLOCK: case VK_FORMAT_ASTC_8x5_SRGB_BLOCK: return {8, 5, 16};
+            case VK_FORMAT_ASTC_8x6_UNORM_BLOCK: case VK_FORMAT_ASTC_8x6_SRGB_BLOCK: return {8, 6, 16};
+            case VK_FORMAT_ASTC_8x8_UNORM_BLOCK: case VK_FORMAT_ASTC_8x8_SRGB_BLOCK: return {8, 8, 16};
+            case VK_FORMAT_ASTC_10x5_UNORM_BLOCK: case VK_FORMAT_ASTC_10x5_SRGB_BLOCK: return {10, 5, 16};
+            case VK_FORMAT_ASTC_10x6_UNORM_BLOCK: case VK_FORMAT_ASTC_10x6_SRGB_BLOCK: return {10, 6, 16};
+            case VK_FORMAT_ASTC_10x8_UNORM_BLOCK: case VK_FORMAT_ASTC_10x8_SRGB_BLOCK: return {10, 8, 16};
+            case VK_FORMAT_ASTC_10x10_UNORM_BLOCK: case VK_FORMAT_ASTC_10x10_SRGB_BLOCK: return {10, 10, 16};
+            case VK_FORMAT_ASTC_12x10_UNORM_BLOCK: case VK_FORMAT_ASTC_12x10_SRGB_BLOCK: return {12, 10, 16};
+            case VK_FORMAT_ASTC_12x12_UNORM_BLOCK: case VK_FORMAT_ASTC_12x12_SRGB_BLOCK: return {12, 12, 16};
+            default:
+                return {1, 1, 0};
+        }
+    }
+
+    //Read only and populated up front, so the render thread's copy into staging never waits on a page fault.
+    std::shared_ptr<const void> mapFile(const std::filesystem::path& path, size_t& size) {
+        int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) {
+            return {};
+        }
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size == 0) {
+            close(file);
+            return {};
+        }
+        size = static_cast<size_t>(status.st_size);
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+        //The mapping stays valid after the descriptor is closed.
+        close(file);
+        if (address == MAP_FAILED) {
+            return {};
+        }
+        return std::shared_ptr<const void>(address, [size](const void* mapped) { munmap(const_cast<void*>(mapped), size); });
+    }
+
+    template <typename T>
+    T readLittleEndian(const std::byte* bytes) {
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    /*
+        <https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html>
+        12 byte identifier, then vkFormat, typeSize, pixelWidth, pixelHeight, pixelDepth, layerCount, faceCount,
+        levelCount and supercompressionScheme as uint32, the data format descriptor, key/value and supercompression
+        global data offsets, and from byte 80 the level index: byteOffset, byteLength and uncompressedByteLength as
+        uint64 per level, level 0 (the largest) first.
+    */
+    constexpr std::array<unsigned char, 12> ktx2Identifier = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    constexpr size_t ktx2LevelIndexOffset = 80;
+
+    std::optional<TextureLoader::DecodedTexture> readKtx2(VkPhysicalDevice physicalDevice, Texture& texture) {
+        size_t size = 0;
+        auto mapping = mapFile(texture.path, size);
+        if (!mapping) {
+            Logging::failure("Couldn't map texture {}.", texture.path.string());
+            return {};
+        }
+        const auto* bytes = static_cast<const std::byte*>(mapping.get());
+
+        if (size < ktx2LevelIndexOffset || std::memcmp(bytes, ktx2Identifier.data(), ktx2Identifier.size()) != 0) {
+            Logging::failure("Texture {} isn't a KTX2 file.", texture.path.string());
+            return {};
+        }
+        auto format = static_cast<VkFormat>(readLittleEndian<uint32_t>(bytes + 12));
+        uint32_t width = readLittleEndian<uint32_t>(bytes + 20);
+        uint32_t height = readLittleEndian<uint32_t>(bytes + 24);
+        uint32_t depth = readLittleEndian<uint32_t>(bytes + 28);
+        uint32_t layers = readLittleEndian<uint32_t>(bytes + 32);
+        uint32_t faces = readLittleEndian<uint32_t>(bytes + 36);
+        uint32_t levels = std::max(readLittleEndian<uint32_t>(bytes + 40), 1u);
+        uint32_t supercompression = readLittleEndian<uint32_t>(bytes + 44);
+
+        if (supercompression != 0 || format == VK_FORMAT_UNDEFINED) {
+            Logging::failure("Texture {} is supercompressed or Basis Universal, which isn't supported.", texture.path.string());
+            return {};
+        }
+        if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1) {
+            Logging::failure("Texture {} isn't a single 2D image.", texture.path.string());
+            return {};
+        }
+        if (!fitsDevice(physicalDevice, texture, width, height)) {
+            return {};
+        }
+        auto block = texelBlock(format);
+        if (block.bytes == 0) {
+            Logging::failure("Texture {} has format {}, which isn't supported in KTX2 files.", texture.path.string(), static_cast<int>(format));
+            return {};
+        }
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+            Logging::failure("Texture {} has format {}, which this device can't sample.", texture.path.string(), static_cast<int>(format));
+            return {};
+        }
+        //The levels are uploaded with vkCmdCopyBufferToImage.
+        if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_TRANSFER_DST_BIT)) {
+            Logging::failure("Texture {} has format {}, which this device can't copy into.", texture.path.string(), static_cast<int>(format));
+            return {};
+        }
+        if (levels > static_cast<uint32_t>(std::bit_width(std::max(width, height))) || ktx2LevelIndexOffset + levels * 24 > size) {
+            Logging::failure("Texture {} has a broken level index.", texture.path.string());
+            return {};
+        }
+
+        TextureLoader::DecodedTexture result{&texture};
+        for (uint32_t level = 0; level < levels; level++) {
+            const auto* entry = bytes + ktx2LevelIndexOffset + level * 24;
+            uint64_t offset = readLittleEndian<uint64_t>(entry);
+            uint64_t length = readLittleEndian<uint64_t>(entry + 8);
+            //Tightly packed blocks, which is what a copy with bufferRowLength 0 reads.
+            uint64_t blocksWide = (std::max(width >> level, 1u) + block.width - 1) / block.width;
+            uint64_t blocksHigh = (std::max(height >> level, 1u) + block.height - 1) / block.height;
+            uint64_t expected = blocksWide * blocksHigh * block.bytes;
+            if (length < expected || offset > size || expected > size - offset) {
+                Logging::failure("Level {} of texture {} is truncated.", level, texture.path.string());
+                return {};
+            }
+            result.levels.push_back({bytes + offset, static_cast<size_t>(expected)});
+            result.size += expected;
+        }
+
+        texture.format = format;
+        texture.extent = {width, height};
+        //A file without levels asks for them to be generated, which only works for formats that can be blitted.
+        texture.mipLevels = levels == 1 && texture.generateMipmaps && readLittleEndian<uint32_t>(bytes + 40) == 0 ?
+            std::bit_width(std::max(width, height)) : levels;
+        result.source = std::move(mapping);
+        return result;
+    }
+
+    std::optional<TextureLoader::DecodedTexture> decodeTexture(VkPhysicalDevice physicalDevice, Texture& texture) {
+        if (texture.path.extension() == ".ktx2") {
+            return readKtx2(physicalDevice, texture);
+        }
+        return decodeImage(physicalDevice, texture);
+    }
+
+    VkPhysicalDeviceFeatures textureCompressionFeatures(VkPhysicalDevice physicalDevice) {
+        VkPhysicalDeviceFeatures supported;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supported);
+
+        VkPhysicalDeviceFeatures features{};
+        features.textureCompressionBC = supported.textureCompressionBC;
+        features.textureCompressionASTC_LDR = supported.textureCompressionASTC_LDR;
+        return features;
+    }
+
+    //The downsample shader's storage image is declared rgba32f, the views it writes have to match.
+    constexpr VkFormat downsampleFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+    bool createTextureImage(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, Texture& texture, MipGeneration mipmaps) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = texture.format;
+        imageInfo.extent = {texture.extent.width, texture.extent.height, 1};
+        imageInfo.mipLevels = texture.mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        if (mipmaps == MipGeneration::Blit) {
+            imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        } else if (mipmaps == MipGeneration::Compute) {
+            imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &texture.image) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the image for texture {}.", texture.path.string());
+            texture.image = VK_NULL_HANDLE;
+            return false;
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(logicalDevice, texture.image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+            vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &texture.memory) != VK_SUCCESS) {
+            Logging::failure("Couldn't allocate {} bytes for texture {}.", memRequirements.size, texture.path.string());
+            texture.memory = VK_NULL_HANDLE;
+            return false;
+        }
+        vkBindImageMemory(logicalDevice, texture.image, texture.memory, 0);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = texture.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = texture.format;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1};
+
+        if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &texture.view) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the image view for texture {}.", texture.path.string());
+            texture.view = VK_NULL_HANDLE;
+            return false;
+        }
+        return true;
+    }
+
+    void destroyTextureImage(VkDevice logicalDevice, Texture& texture) {
+        if (texture.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(logicalDevice, texture.view, nullptr);
+        }
+        if (texture.image != VK_NULL_HANDLE) {
+            vkDestroyImage(logicalDevice, texture.image, nullptr);
+        }
+        if (texture.memory != VK_NULL_HANDLE) {
+            vkFreeMemory(logicalDevice, texture.memory, nullptr);
+        }
+        texture.view = VK_NULL_HANDLE;
+        texture.image = VK_NULL_HANDLE;
+        texture.memory = VK_NULL_HANDLE;
+    }
+
+    VkImageMemoryBarrier textureBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccess, VkAccessFlags dstAccess, uint32_t baseLevel, uint32_t levelCount) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, 1};
+        return barrier;
+    }
+
+    VkImageView createLevelView(VkDevice logicalDevice, VkImage image, VkFormat format, uint32_t level) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+
+        VkImageView view = VK_NULL_HANDLE;
+        if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+        return view;
+    }
+
+    uint32_t maxMipLevels(std::span<Texture* const> textures) {
+        uint32_t levels = 0;
+        for (const auto* texture : textures) {
+            levels = std::max(levels, texture->mipLevels);
+        }
+        return levels;
+    }
+
+    //Each level is blitted from the one above it, which is moved to TRANSFER_SRC first. Every texture's level n
+    //shares one barrier call. Afterwards the levels are in TRANSFER_SRC except the last, still TRANSFER_DST.
+    void recordBlitMipmaps(VkCommandBuffer commandBuffer, std::span<Texture* const> textures, std::vector<VkImageMemoryBarrier>& finalBarriers) {
+        std::vector<VkImageMemoryBarrier> barriers;
+        for (uint32_t level = 1; level < maxMipLevels(textures); level++) {
+            barriers.clear();
+            for (const auto* texture : textures) {
+                if (level < texture->mipLevels) {
+                    barriers.push_back(textureBarrier(texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, level - 1, 1));
+                }
+            }
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+            for (const auto* texture : textures) {
+                if (level >= texture->mipLevels) {
+                    continue;
+                }
+                VkImageBlit blit{};
+                blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+                blit.srcOffsets[1] = {
+                    static_cast<int32_t>(std::max(texture->extent.width >> (level - 1), 1u)),
+                    static_cast<int32_t>(std::max(texture->extent.height >> (level - 1), 1u)), 1};
+                blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+                blit.dstOffsets[1] = {
+                    static_cast<int32_t>(std::max(texture->extent.width >> level, 1u)),
+                    static_cast<int32_t>(std::max(texture->extent.height >> level, 1u)), 1};
+                vkCmdBlitImage(commandBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+            }
+        }
+
+        for (const auto* texture : textures) {
+            uint32_t last = texture->mipLevels - 1;
+            finalBarriers.push_back(textureBarrier(texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, 0, last));
+            finalBarriers.push_back(textureBarrier(texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, last, 1));
+        }
+    }
+
+    struct DownsampleParameters {
+        int32_t width;
+        int32_t height;
+    };
+
+    constexpr std::array<Descriptors::PoolSizeRatio, 2> downsamplePoolRatios = {{
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f}
+    }};
+
+    //Level n is read through a view of level n - 1, already moved to SHADER_READ_ONLY, and written through a
+    //storage view. Afterwards every level is SHADER_READ_ONLY except the last, still GENERAL.
+    void recordComputeMipmaps(VkDevice logicalDevice, VkCommandBuffer commandBuffer, const ComputePipeline& downsample, VkSampler sampler,
+        const PushDescriptorFunctions* pushDescriptors, std::span<Texture* const> textures, TextureLoader::UploadBatch& batch,
+        std::vector<VkImageMemoryBarrier>& finalBarriers) {
+        if (pushDescriptors == nullptr) {
+            uint32_t sets = 0;
+            for (const auto* texture : textures) {
+                sets += texture->mipLevels - 1;
+            }
+            batch.descriptors.create(logicalDevice, sets, downsamplePoolRatios);
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsample.pipeline);
+
+        std::vector<VkImageMemoryBarrier> barriers;
+        for (uint32_t level = 1; level < maxMipLevels(textures); level++) {
+            barriers.clear();
+            for (const auto* texture : textures) {
+                if (level >= texture->mipLevels) {
+                    continue;
+                }
+                //Level 0 was written by the copy, the others by the previous dispatch.
+                bool copied = level == 1;
+                barriers.push_back(textureBarrier(texture->image,
+                    copied ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    copied ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, level - 1, 1));
+                barriers.push_back(textureBarrier(texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                    0, VK_ACCESS_SHADER_WRITE_BIT, level, 1));
+            }
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+            for (const auto* texture : textures) {
+                if (level >= texture->mipLevels) {
+                    continue;
+                }
+                VkImageView source = createLevelView(logicalDevice, texture->image, texture->format, level - 1);
+                VkImageView destination = createLevelView(logicalDevice, texture->image, texture->format, level);
+                VkDescriptorSet set = pushDescriptors == nullptr ? batch.descriptors.allocate(logicalDevice, downsample.setLayouts[0]) : VK_NULL_HANDLE;
+                for (auto view : {source, destination}) {
+                    if (view != VK_NULL_HANDLE) {
+                        batch.levelViews.push_back(view);
+                    }
+                }
+                if (source == VK_NULL_HANDLE || destination == VK_NULL_HANDLE || (pushDescriptors == nullptr && set == VK_NULL_HANDLE)) {
+                    Logging::warning("Couldn't generate mip level {} of texture {}.", level, texture->path.string());
+                    continue;
+                }
+
+                Descriptors::DescriptorWriter writes;
+                writes.sampledImage(0, source, sampler).storageImage(1, destination);
+                if (pushDescriptors != nullptr) {
+                    pushDescriptors->pushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsample.layout, 0,
+                        static_cast<uint32_t>(writes.writes.size()), writes.writes.data());
+                } else {
+                    writes.apply(logicalDevice, set);
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsample.layout, 0, 1, &set, 0, nullptr);
+                }
+
+                DownsampleParameters parameters{
+                    static_cast<int32_t>(std::max(texture->extent.width >> level, 1u)),
+                    static_cast<int32_t>(std::max(texture->extent.height >> level, 1u))
+                };
+                vkCmdPushConstants(commandBuffer, downsample.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+                auto groups = downsample.groupCount(parameters.width, parameters.height);
+                vkCmdDispatch(commandBuffer, groups[0], groups[1], groups[2]);
+            }
+        }
+
+        for (const auto* texture : textures) {
+            finalBarriers.push_back(textureBarrier(texture->image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, texture->mipLevels - 1, 1));
+        }
+    }
+
+    void releaseBatch(VkDevice logicalDevice, VkCommandPool commandPool, TextureLoader::UploadBatch& batch) {
+        for (auto view : batch.levelViews) {
+            vkDestroyImageView(logicalDevice, view, nullptr);
+        }
+        batch.levelViews.clear();
+        batch.descriptors.destroy(logicalDevice);
+        vkDestroyFence(logicalDevice, batch.fence, nullptr);
+        vkFreeCommandBuffers(logicalDevice, commandPool, 1, &batch.commandBuffer);
+        vkDestroyBuffer(logicalDevice, batch.staging, nullptr);
+        vkFreeMemory(logicalDevice, batch.stagingMemory, nullptr);
+    }
+
+    bool TextureLoader::start(VkPhysicalDevice physical, VkDevice device, VkQueue uploadQueue, uint32_t workerCount) {
+        physicalDevice = physical;
+        logicalDevice = device;
+        queue = uploadQueue;
+        stopping = false;
+
+        //Separate from the frame's pool, upload command buffers are short lived and freed when their batch retires.
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = findQueueFamilies(physicalDevice).graphicsFamily.value();
+        if (vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+            commandPool = VK_NULL_HANDLE;
+            Logging::failure("Couldn't create the texture upload command pool.");
+            return false;
+        }
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.minLod = 0.0f;
+        //Each view limits itself to the texture's own levels.
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the texture sampler.");
+            sampler = VK_NULL_HANDLE;
+            return false;
+        }
+        //For formats without SAMPLED_IMAGE_FILTER_LINEAR, which includes RGBA32F on many devices.
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &nearestSampler) != VK_SUCCESS) {
+            Logging::failure("Couldn't create the nearest texture sampler.");
+            nearestSampler = VK_NULL_HANDLE;
+            return false;
+        }
+
+        if (workerCount == 0) {
+            workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        }
+        Logging::info("Texture loader starting {} workers.", workerCount);
+
+        for (uint32_t i = 0; i < workerCount; i++) {
+            workers.emplace_back([this]() {
+                while (true) {
+                    Texture* texture;
+                    {
+                        std::unique_lock lock(mutex);
+                        jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                        if (jobs.empty()) {
+                            return;
+                        }
+                        texture = jobs.front();
+                        jobs.pop_front();
+                        jobsInProgress++;
+                    }
+
+                    auto result = decodeTexture(physicalDevice, *texture);
+
+                    {
+                        std::lock_guard lock(mutex);
+                        jobsInProgress--;
+                        if (result) {
+                            decoded.push_back(std::move(*result));
+                        } else {
+                            texture->status.store(TextureStatus::Failed, std::memory_order_release);
+                        }
+                    }
+                    jobsChanged.notify_all();
+                }
+            });
+        }
+        return true;
+    }
+
+    void TextureLoader::stop() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            //Files nobody has started decoding turn Failed, so waitIdle() and handles polling them don't wait forever.
+            for (auto* texture : jobs) {
+                texture->status.store(TextureStatus::Failed, std::memory_order_release);
+            }
+            jobs.clear();
+        }
+        jobsChanged.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    TextureLoader::~TextureLoader() {
+        stop();
+    }
+
+    void TextureLoader::destroy() {
+        stop();
+        for (auto& texture : decoded) {
+            texture.texture->status.store(TextureStatus::Failed, std::memory_order_release);
+        }
+        decoded.clear();
+        //With nothing left decoded, update() only retires.
+        for (auto& batch : uploads) {
+            vkWaitForFences(logicalDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        }
+        update();
+
+        for (auto& texture : textures) {
+            destroyTextureImage(logicalDevice, texture);
+        }
+        textures.clear();
+
+        if (sampler != VK_NULL_HANDLE) {
+            vkDestroySampler(logicalDevice, sampler, nullptr);
+            sampler = VK_NULL_HANDLE;
+        }
+        if (nearestSampler != VK_NULL_HANDLE) {
+            vkDestroySampler(logicalDevice, nearestSampler, nullptr);
+            nearestSampler = VK_NULL_HANDLE;
+        }
+        if (downsampleSampler != VK_NULL_HANDLE) {
+            vkDestroySampler(logicalDevice, downsampleSampler, nullptr);
+            downsampleSampler = VK_NULL_HANDLE;
+        }
+        downsample.destroy(logicalDevice);
+        if (commandPool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+            commandPool = VK_NULL_HANDLE;
+        }
+    }
+
+    bool TextureLoader::enableComputeMipmaps(ShaderReflectionCache& reflections, const PipelineCache& pipelineCache, bool preferDiskShaders,
+        const PushDescriptorFunctions* pushDescriptorFunctions) {
+        if (reflections.setLayoutFlags != 0) {
+            Logging::warning("Compute mipmaps need pool allocated descriptor sets, textures without linear blits keep one level.");
+            return false;
+        }
+        if (reflections.pushDescriptorSets.contains(0)) {
+            if (pushDescriptorFunctions == nullptr) {
+                Logging::warning("The downsample set is pushed but no push functions were given, textures without linear blits keep one level.");
+                return false;
+            }
+            pushDescriptors = pushDescriptorFunctions;
+        }
+        downsample = createComputePipeline(logicalDevice, "Shaders/downsample.spv", reflections, pipelineCache, {}, preferDiskShaders);
+        if (!downsample.valid() || downsample.setLayouts.empty()) {
+            Logging::warning("Couldn't build the downsample shader, textures without linear blits keep one level.");
+            downsample.destroy(logicalDevice);
+            return false;
+        }
+
+        //The shader only uses texelFetch, the formats it runs on can't be filtered.
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &downsampleSampler) != VK_SUCCESS) {
+            Logging::warning("Couldn't create the downsample sampler, textures without linear blits keep one level.");
+            downsampleSampler = VK_NULL_HANDLE;
+            downsample.destroy(logicalDevice);
+            return false;
+        }
+        return true;
+    }
+
+    MipGeneration TextureLoader::mipGeneration(const Texture& texture) {
+        if (texture.mipLevels <= 1) {
+            return MipGeneration::None;
+        }
+
+        auto supported = features(texture.format);
+        constexpr VkFormatFeatureFlags linearBlit =
+            VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((supported & linearBlit) == linearBlit) {
+            return MipGeneration::Blit;
+        }
+        //No filtering needed, the shader averages each 2x2 block with texelFetch.
+        if (downsample.valid() && texture.format == downsampleFormat && (supported & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+            return MipGeneration::Compute;
+        }
+        Logging::warning("Texture {} can't have mips generated for its format, keeping one level.", texture.path.string());
+        return MipGeneration::None;
+    }
+
+    VkFormatFeatureFlags TextureLoader::features(VkFormat format) {
+        auto found = formatFeatures.find(format);
+        if (found == formatFeatures.end()) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+            found = formatFeatures.emplace(format, properties.optimalTilingFeatures).first;
+        }
+        return found->second;
+    }
+
+    TextureHandle TextureLoader::load(const std::filesystem::path& path, bool srgb, bool generateMipmaps) {
+        Texture* texture;
+        {
+            std::lock_guard lock(mutex);
+            texture = &textures.emplace_back();
+            texture->path = path;
+            texture->format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+            texture->sampler = sampler;
+            texture->generateMipmaps = generateMipmaps;
+            if (stopping) {
+                texture->status.store(TextureStatus::Failed, std::memory_order_release);
+                return {texture};
+            }
+            jobs.push_back(texture);
+        }
+        jobsChanged.notify_one();
+        return {texture};
+    }
+
+    const Texture* TextureLoader::get(TextureHandle handle) const {
+        if (status(handle) != TextureStatus::Ready) {
+            return nullptr;
+        }
+        return handle.texture;
+    }
+
+    TextureStatus TextureLoader::status(TextureHandle handle) const {
+        if (!handle.valid()) {
+            return TextureStatus::Failed;
+        }
+        return handle.texture->status.load(std::memory_order_acquire);
+    }
+
+    void TextureLoader::update() {
+        std::erase_if(uploads, [&](UploadBatch& batch) {
+            if (vkGetFenceStatus(logicalDevice, batch.fence) != VK_SUCCESS) {
+                return false;
+            }
+            for (auto* texture : batch.textures) {
+                texture->status.store(TextureStatus::Ready, std::memory_order_release);
+            }
+            releaseBatch(logicalDevice, commandPool, batch);
+            return true;
+        });
+
+        std::vector<DecodedTexture> batchTextures;
+        {
+            std::lock_guard lock(mutex);
+            VkDeviceSize batchSize = 0;
+            size_t taken = 0;
+            while (taken < decoded.size() && (taken == 0 || batchSize + decoded[taken].size <= uploadBudget)) {
+                batchSize += decoded[taken].size;
+                taken++;
+            }
+            std::move(decoded.begin(), decoded.begin() + taken, std::back_inserter(batchTextures));
+            decoded.erase(decoded.begin(), decoded.begin() + taken);
+        }
+        if (batchTextures.empty()) {
+            return;
+        }
+
+        //Images first, a texture that can't get one fails alone rather than taking the batch with it.
+        VkDeviceSize stagingSize = 0;
+        std::erase_if(batchTextures, [&](DecodedTexture& pending) {
+            //Files with pre-baked levels have every level already.
+            bool complete = pending.levels.size() == pending.texture->mipLevels;
+            //Set before the texture turns Ready, which publishes it to the render thread.
+            bool filterable = features(pending.texture->format) & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+            pending.texture->sampler = filterable ? sampler : nearestSampler;
+            pending.mipmaps = complete ? MipGeneration::None : mipGeneration(*pending.texture);
+            if (pending.mipmaps == MipGeneration::None) {
+                pending.texture->mipLevels = static_cast<uint32_t>(pending.levels.size());
+            }
+            if (!createTextureImage(physicalDevice, logicalDevice, *pending.texture, pending.mipmaps)) {
+                destroyTextureImage(logicalDevice, *pending.texture);
+                pending.texture->status.store(TextureStatus::Failed, std::memory_order_release);
+                return true;
+            }
+            return false;
+        });
+        if (batchTextures.empty()) {
+            return;
+        }
+        //One copy region per level, each level starting on stagingAlignment.
+        std::vector<std::vector<VkBufferImageCopy>> regions(batchTextures.size());
+        for (size_t i = 0; i < batchTextures.size(); i++) {
+            const auto* texture = batchTextures[i].texture;
+            for (uint32_t level = 0; level < batchTextures[i].levels.size(); level++) {
+                stagingSize = (stagingSize + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+                auto& region = regions[i].emplace_back();
+                region.bufferOffset = stagingSize;
+                region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+                region.imageExtent = {std::max(texture->extent.width >> level, 1u), std::max(texture->extent.height >> level, 1u), 1};
+                stagingSize += batchTextures[i].levels[level].size();
+            }
+        }
+
+        UploadBatch batch;
+        std::tie(batch.staging, batch.stagingMemory) = createBuffer(
+            physicalDevice, logicalDevice, stagingSize,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-        void* data;
-        vkMapMemory(logicalDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(logicalDevice, stagingBufferMemory);
+        void* stagingData;
+        vkMapMemory(logicalDevice, batch.stagingMemory, 0, stagingSize, 0, &stagingData);
+        for (size_t i = 0; i < batchTextures.size(); i++) {
+            for (size_t level = 0; level < batchTextures[i].levels.size(); level++) {
+                const auto& data = batchTextures[i].levels[level];
+                std::memcpy(static_cast<std::byte*>(stagingData) + regions[i][level].bufferOffset, data.data(), data.size());
+            }
+        }
+        vkUnmapMemory(logicalDevice, batch.stagingMemory);
+        //Every level is in staging, so the pixels or the file mapping can go now.
+        for (auto& pending : batchTextures) {
+            pending.levels.clear();
+            pending.source.reset();
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(logicalDevice, &allocInfo, &batch.commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
 
-        stbi_image_free(pixels);
+        std::vector<VkImageMemoryBarrier> barriers;
+        barriers.reserve(batchTextures.size());
+        for (const auto& pending : batchTextures) {
+            barriers.push_back(textureBarrier(pending.texture->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                0, VK_ACCESS_TRANSFER_WRITE_BIT, 0, pending.texture->mipLevels));
+        }
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
 
-        VkImage textureImage;
-        VkDeviceMemory textureImageMemory;
+        for (size_t i = 0; i < batchTextures.size(); i++) {
+            vkCmdCopyBufferToImage(batch.commandBuffer, batch.staging, batchTextures[i].texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(regions[i].size()), regions[i].data());
+        }
+
+        //Every level of every texture ends up SHADER_READ_ONLY through one last barrier call.
+        barriers.clear();
+        std::vector<Texture*> blitted;
+        std::vector<Texture*> computed;
+        for (const auto& pending : batchTextures) {
+            if (pending.mipmaps == MipGeneration::Blit) {
+                blitted.push_back(pending.texture);
+            } else if (pending.mipmaps == MipGeneration::Compute) {
+                computed.push_back(pending.texture);
+            } else {
+                barriers.push_back(textureBarrier(pending.texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, pending.texture->mipLevels));
+            }
+        }
+        if (!blitted.empty()) {
+            recordBlitMipmaps(batch.commandBuffer, blitted, barriers);
+        }
+        if (!computed.empty()) {
+            recordComputeMipmaps(logicalDevice, batch.commandBuffer, downsample, downsampleSampler, pushDescriptors, computed, batch, barriers);
+        }
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        vkEndCommandBuffer(batch.commandBuffer);
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(logicalDevice, &fenceInfo, nullptr, &batch.fence);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        if (vkQueueSubmit(queue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+            Logging::failure("Couldn't submit a texture upload batch of {} textures.", batchTextures.size());
+            for (const auto& pending : batchTextures) {
+                destroyTextureImage(logicalDevice, *pending.texture);
+                pending.texture->status.store(TextureStatus::Failed, std::memory_order_release);
+            }
+            releaseBatch(logicalDevice, commandPool, batch);
+            return;
+        }
+
+        for (const auto& pending : batchTextures) {
+            batch.textures.push_back(pending.texture);
+        }
+        uploads.push_back(std::move(batch));
+    }
+
+    bool TextureLoader::busy() {
+        std::lock_guard lock(mutex);
+        return !jobs.empty() || jobsInProgress != 0 || !decoded.empty() || !uploads.empty();
+    }
 
+    void TextureLoader::waitIdle() {
+        {
+            std::unique_lock lock(mutex);
+            jobsChanged.wait(lock, [this]() { return jobs.empty() && jobsInProgress == 0; });
+        }
+        //Each round retires the previous batch and submits the next, until nothing is left to upload.
+        while (true) {
+            update();
+            if (uploads.empty()) {
+                return;
+            }
+            std::vector<VkFence> fences;
+            for (const auto& batch : uploads) {
+                fences.push_back(batch.fence);
+            }
+            vkWaitForFences(logicalDevice, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX);
+        }
     }
-}
\ No newline at end of file
+}
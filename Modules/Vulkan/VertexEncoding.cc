@@ -0,0 +1,204 @@
+module;
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+export module VertexEncoding;
+
+import std;
+import Descriptors;
+
+/*
+    Converts float mesh data into the packed vertex formats at load time: half float positions, octahedral SNORM16
+    normals, UNORM8 colors and UNORM16 texture coordinates. Each encoder writes one attribute stream, so the output
+    can be uploaded as separate streams or interleaved into PackedVertex with packVertices.
+
+    The encoders work on four lanes at a time with GCC vector extensions, which lower to SSE2 or NEON without any
+    target specific intrinsics or extra compile flags. Inputs that aren't a multiple of four are padded internally.
+*/
+
+export namespace Descriptors {
+
+    //One half per input value, rounded to nearest even. Out of range values become infinity, NaN stays NaN.
+    void encodeHalf(std::span<const float> values, std::span<std::uint16_t> halves);
+
+    //w is set to 1.
+    void encodePositions(std::span<const glm::vec3> positions, std::span<Half4> packed);
+
+    //Normals don't need to be normalized, zero length normals encode as +Z.
+    void encodeNormals(std::span<const glm::vec3> normals, std::span<OctahedralNormal> packed);
+
+    //Clamped to [0, 1].
+    void encodeColors(std::span<const glm::vec4> colors, std::span<Unorm8x4> packed);
+
+    //Clamped to [0, 1], wrap or tile in the shader for repeating coordinates.
+    void encodeTextureCoordinates(std::span<const glm::vec2> uvs, std::span<Unorm16x2> packed);
+
+    //Interleaves the encoded streams. Missing attributes (empty spans) get +Z normals, white and uv 0.
+    std::vector<PackedVertex> packVertices(
+        std::span<const glm::vec3> positions,
+        std::span<const glm::vec3> normals = {},
+        std::span<const glm::vec4> colors = {},
+        std::span<const glm::vec2> uvs = {}
+    );
+
+}
+
+namespace Descriptors {
+    using Float4 = float __attribute__((vector_size(16)));
+    using Int4 = std::int32_t __attribute__((vector_size(16)));
+    using Uint4 = std::uint32_t __attribute__((vector_size(16)));
+
+    constexpr size_t lanes = 4;
+
+    Float4 splat(float value) {
+        return Float4{value, value, value, value};
+    }
+
+    Uint4 splat(std::uint32_t value) {
+        return Uint4{value, value, value, value};
+    }
+
+    Float4 load(const float* values, size_t count) {
+        Float4 loaded{};
+        std::memcpy(&loaded, values, std::min(count, lanes) * sizeof(float));
+        return loaded;
+    }
+
+    Float4 absolute(Float4 value) {
+        return std::bit_cast<Float4>(std::bit_cast<Uint4>(value) & 0x7FFFFFFFu);
+    }
+
+    Float4 clamp(Float4 value, float low, float high) {
+        value = value < splat(low) ? splat(low) : value;
+        return value > splat(high) ? splat(high) : value;
+    }
+
+    //Scales [0, 1] or [-1, 1] to the integer range and rounds half away from zero.
+    Int4 quantize(Float4 value, float scale) {
+        Float4 scaled = value * scale;
+        return __builtin_convertvector(scaled + (scaled < splat(0.0f) ? splat(-0.5f) : splat(0.5f)), Int4);
+    }
+
+    //Branch free float to half for four values at once, the exponent rebias and rounding are done by the float
+    //unit, see Maratyszcza's FP16 library.
+    Uint4 toHalf(Float4 value) {
+        Uint4 bits = std::bit_cast<Uint4>(value);
+        Float4 base = (absolute(value) * splat(0x1.0p+112f)) * splat(0x1.0p-110f);
+
+        Uint4 doubled = bits + bits;
+        Uint4 sign = bits & 0x80000000u;
+        Uint4 bias = doubled & 0xFF000000u;
+        bias = bias < splat(0x71000000u) ? splat(0x71000000u) : bias;
+
+        base = std::bit_cast<Float4>((bias >> 1) + 0x07800000u) + base;
+        Uint4 baseBits = std::bit_cast<Uint4>(base);
+        Uint4 exponent = (baseBits >> 13) & 0x00007C00u;
+        Uint4 mantissa = baseBits & 0x00000FFFu;
+        Uint4 nonSign = exponent + mantissa;
+        return (sign >> 16) | (doubled > splat(0xFF000000u) ? splat(0x7E00u) : nonSign);
+    }
+
+    void encodeHalf(std::span<const float> values, std::span<std::uint16_t> halves) {
+        size_t count = std::min(values.size(), halves.size());
+        for (size_t i = 0; i < count; i += lanes) {
+            Uint4 encoded = toHalf(load(values.data() + i, count - i));
+            for (size_t lane = 0; lane < std::min(lanes, count - i); lane++) {
+                halves[i + lane] = static_cast<std::uint16_t>(encoded[lane]);
+            }
+        }
+    }
+
+    void encodePositions(std::span<const glm::vec3> positions, std::span<Half4> packed) {
+        size_t count = std::min(positions.size(), packed.size());
+        for (size_t i = 0; i < count; i++) {
+            Uint4 encoded = toHalf(Float4{positions[i].x, positions[i].y, positions[i].z, 1.0f});
+            packed[i].bits = {
+                static_cast<std::uint16_t>(encoded[0]), static_cast<std::uint16_t>(encoded[1]),
+                static_cast<std::uint16_t>(encoded[2]), static_cast<std::uint16_t>(encoded[3])
+            };
+        }
+    }
+
+    void encodeNormals(std::span<const glm::vec3> normals, std::span<OctahedralNormal> packed) {
+        size_t count = std::min(normals.size(), packed.size());
+        for (size_t i = 0; i < count; i += lanes) {
+            //Transposed so each vector holds one component of four normals.
+            Float4 x{}, y{}, z{};
+            size_t active = std::min(lanes, count - i);
+            for (size_t lane = 0; lane < active; lane++) {
+                x[lane] = normals[i + lane].x;
+                y[lane] = normals[i + lane].y;
+                z[lane] = normals[i + lane].z;
+            }
+
+            Float4 length = absolute(x) + absolute(y) + absolute(z);
+            Float4 inverse = length > splat(0.0f) ? splat(1.0f) / length : splat(0.0f);
+            Float4 octX = x * inverse;
+            Float4 octY = y * inverse;
+
+            //The lower hemisphere folds over the diagonals onto the outer triangles.
+            Float4 signX = octX < splat(0.0f) ? splat(-1.0f) : splat(1.0f);
+            Float4 signY = octY < splat(0.0f) ? splat(-1.0f) : splat(1.0f);
+            Float4 foldedX = (splat(1.0f) - absolute(octY)) * signX;
+            Float4 foldedY = (splat(1.0f) - absolute(octX)) * signY;
+            octX = z < splat(0.0f) ? foldedX : octX;
+            octY = z < splat(0.0f) ? foldedY : octY;
+
+            Int4 snormX = quantize(clamp(octX, -1.0f, 1.0f), 32767.0f);
+            Int4 snormY = quantize(clamp(octY, -1.0f, 1.0f), 32767.0f);
+            for (size_t lane = 0; lane < active; lane++) {
+                packed[i + lane].bits = {static_cast<std::int16_t>(snormX[lane]), static_cast<std::int16_t>(snormY[lane])};
+            }
+        }
+    }
+
+    void encodeColors(std::span<const glm::vec4> colors, std::span<Unorm8x4> packed) {
+        size_t count = std::min(colors.size(), packed.size());
+        for (size_t i = 0; i < count; i++) {
+            Int4 unorm = quantize(clamp(Float4{colors[i].r, colors[i].g, colors[i].b, colors[i].a}, 0.0f, 1.0f), 255.0f);
+            packed[i].bits = {
+                static_cast<std::uint8_t>(unorm[0]), static_cast<std::uint8_t>(unorm[1]),
+                static_cast<std::uint8_t>(unorm[2]), static_cast<std::uint8_t>(unorm[3])
+            };
+        }
+    }
+
+    void encodeTextureCoordinates(std::span<const glm::vec2> uvs, std::span<Unorm16x2> packed) {
+        size_t count = std::min(uvs.size(), packed.size());
+        //Two coordinates per vector.
+        for (size_t i = 0; i < count; i += 2) {
+            Float4 values{uvs[i].x, uvs[i].y, 0.0f, 0.0f};
+            if (i + 1 < count) {
+                values[2] = uvs[i + 1].x;
+                values[3] = uvs[i + 1].y;
+            }
+            Int4 unorm = quantize(clamp(values, 0.0f, 1.0f), 65535.0f);
+            packed[i].bits = {static_cast<std::uint16_t>(unorm[0]), static_cast<std::uint16_t>(unorm[1])};
+            if (i + 1 < count) {
+                packed[i + 1].bits = {static_cast<std::uint16_t>(unorm[2]), static_cast<std::uint16_t>(unorm[3])};
+            }
+        }
+    }
+
+    std::vector<PackedVertex> packVertices(
+        std::span<const glm::vec3> positions, std::span<const glm::vec3> normals,
+        std::span<const glm::vec4> colors, std::span<const glm::vec2> uvs) {
+        size_t count = positions.size();
+        std::vector<Half4> packedPositions(count);
+        std::vector<OctahedralNormal> packedNormals(count, OctahedralNormal{{0, 0}});
+        std::vector<Unorm8x4> packedColors(count, Unorm8x4{{255, 255, 255, 255}});
+        std::vector<Unorm16x2> packedUvs(count, Unorm16x2{{0, 0}});
+
+        encodePositions(positions, packedPositions);
+        encodeNormals(normals, packedNormals);
+        encodeColors(colors, packedColors);
+        encodeTextureCoordinates(uvs, packedUvs);
+
+        std::vector<PackedVertex> vertices(count);
+        for (size_t i = 0; i < count; i++) {
+            vertices[i] = {packedPositions[i], packedNormals[i], packedColors[i], packedUvs[i]};
+        }
+        return vertices;
+    }
+}
@@ -0,0 +1,47 @@
+# Writes a C++ module holding SPIR-V binaries as constexpr word arrays.
+# Usage: cmake -DOUTPUT=<module.cc> -DSHADERS="<runtime path>=<spv file>;..." -P EmbedSpirv.cmake
+
+set(DEFINITIONS "")
+set(ENTRIES "")
+set(INDEX 0)
+
+foreach(SHADER ${SHADERS})
+    string(REPLACE "=" ";" PARTS "${SHADER}")
+    list(GET PARTS 0 RUNTIME_PATH)
+    list(GET PARTS 1 SPIRV_FILE)
+
+    file(READ "${SPIRV_FILE}" HEX HEX)
+    # SPIR-V is a stream of little endian words, so each group of four bytes is reversed into one literal.
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " WORDS "${HEX}")
+
+    string(APPEND DEFINITIONS "    alignas(16) constexpr std::uint32_t spirv${INDEX}[] = {${WORDS}};\n")
+    string(APPEND ENTRIES "        EmbeddedShader{\"${RUNTIME_PATH}\", spirv${INDEX}},\n")
+    math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}.tmp"
+"//Generated by cmake/EmbedSpirv.cmake, do not edit.
+export module EmbeddedShaders;
+
+import std;
+
+namespace Shaders {
+${DEFINITIONS}}
+
+export namespace Shaders {
+
+    struct EmbeddedShader {
+        std::string_view path;
+        std::span<const std::uint32_t> code;
+    };
+
+    //Keyed by the path the shader would otherwise be read from, IE Shaders/vert.spv.
+    constexpr std::array<EmbeddedShader, ${INDEX}> embeddedShaders = {
+${ENTRIES}    };
+
+}
+")
+
+# Only touch the module when it changed, so unrelated shader edits don't rebuild everything importing it.
+file(COPY_FILE "${OUTPUT}.tmp" "${OUTPUT}" ONLY_IF_DIFFERENT)
+file(REMOVE "${OUTPUT}.tmp")
@@ -14,13 +14,30 @@ import Commands;
 import Presentation;
 import Logging;
 import Descriptors;
+import DescriptorCache;
 import Buffers;
+import FramePacing;
+import FrameStatistics;
+import Readback;
+import PipelineCache;
+import PipelineCompiler;
+import PipelineState;
+import PipelineStateCache;
+import ShaderHotReload;
+import ShaderReflection;
+import ShaderObjects;
+import DescriptorBuffer;
+import DescriptorTemplates;
+import Textures;
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
 constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 
+//Driver pipeline cache, persisted between runs next to the log.
+constexpr const char *PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
 //64Mb of statically allocated vertex buffer in this case.
 constexpr uint32_t INDEXED_VERTEX_BUFFER_STATIC_ALLOCATION_SIZE = 64 * 1024 * 1024;
 
@@ -28,35 +45,137 @@ const std::vector<const char *> requiredDeviceExtensions = {
   VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+//Input-to-photon latency over peak FPS, see FramePacing.cc.
+const Vulkan::FramePacingConfig framePacingConfig = {
+  .mode = Vulkan::PacingMode::LowLatency,
+  .targetFps = 60.0
+};
+
+//Production default, tear free with low latency. Switch at runtime with keys 1-4.
+const Vulkan::SwapChainPolicy swapChainPolicy = {
+  .presentMode = Vulkan::PresentPolicy::Mailbox,
+  .imageCount = 0
+};
+
+const std::array<std::pair<int, Vulkan::PresentPolicy>, 4> presentPolicyKeys = {{
+  {GLFW_KEY_1, Vulkan::PresentPolicy::Immediate},
+  {GLFW_KEY_2, Vulkan::PresentPolicy::Mailbox},
+  {GLFW_KEY_3, Vulkan::PresentPolicy::Fifo},
+  {GLFW_KEY_4, Vulkan::PresentPolicy::FifoRelaxed}
+}};
+
+constexpr uint32_t DEFAULT_HEADLESS_FRAMES = 1000;
+
+//Recompiled on save with --hot-reload.
+const std::vector<Shaders::ShaderSource> hotReloadShaders = {
+  {"Shaders/basic.vert", "Shaders/vert.spv"},
+  {"Shaders/basic.frag", "Shaders/frag.spv"}
+};
+
+const std::filesystem::path DEFAULT_TEXTURE_DIRECTORY = "Resources/Textures";
+
+struct LaunchOptions {
+  bool headless = false;
+  bool hotReload = false;
+  bool shaderObjects = false;
+  bool descriptorBuffer = false;
+  bool transientDescriptors = false;
+  uint32_t headlessFrames = DEFAULT_HEADLESS_FRAMES;
+  bool capture = false;
+  Vulkan::ReadbackConfig captureConfig;
+  std::filesystem::path textureDirectory = DEFAULT_TEXTURE_DIRECTORY;
+};
+
+//Usage: VulkanApp [options]
+//  --headless [frames]          Render frames through VK_EXT_headless_surface with no window, then report timings.
+//  --hot-reload                 Recompile shaders on save and swap the affected pipelines in, needs glslc on the PATH.
+//  --shader-objects             Set all state while recording with VK_EXT_shader_object instead of using pipelines.
+//  --descriptor-buffer          Write descriptors into a VK_EXT_descriptor_buffer instead of allocating sets.
+//  --transient-descriptors      Allocate and write the frame's sets from per frame pools instead of the set cache.
+//  --capture <directory>        Write every presented frame to disk from a background thread.
+//  --capture-format png|ppm|raw
+//  --textures <directory>       Decode and upload every texture in the directory while frames keep rendering.
+LaunchOptions parseLaunchOptions(int argc, char **argv) {
+  LaunchOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg == "--headless") {
+      options.headless = true;
+      if (i + 1 < argc) {
+        uint32_t frames = 0;
+        std::string_view count = argv[i + 1];
+        if (std::from_chars(count.data(), count.data() + count.size(), frames).ec == std::errc{} && frames > 0) {
+          options.headlessFrames = frames;
+          i++;
+        }
+      }
+    } else if (arg == "--hot-reload") {
+      options.hotReload = true;
+    } else if (arg == "--shader-objects") {
+      options.shaderObjects = true;
+    } else if (arg == "--descriptor-buffer") {
+      options.descriptorBuffer = true;
+    } else if (arg == "--transient-descriptors") {
+      options.transientDescriptors = true;
+    } else if (arg == "--capture" && i + 1 < argc) {
+      options.capture = true;
+      options.captureConfig.directory = argv[++i];
+    } else if (arg == "--textures" && i + 1 < argc) {
+      options.textureDirectory = argv[++i];
+    } else if (arg == "--capture-format" && i + 1 < argc) {
+      std::string_view format = argv[++i];
+      if (format == "ppm") {
+        options.captureConfig.format = Vulkan::ImageFileFormat::Ppm;
+      } else if (format == "raw") {
+        options.captureConfig.format = Vulkan::ImageFileFormat::Raw;
+      } else if (format == "png") {
+        options.captureConfig.format = Vulkan::ImageFileFormat::Png;
+      } else {
+        Logging::warning("Unknown capture format {}, using png.", format);
+      }
+    } else {
+      Logging::warning("Ignoring unknown argument {}.", arg);
+    }
+  }
+  return options;
+}
+
 using deferred = std::function<void()>;
 
-int main() {
+int main(int argc, char **argv) {
   // Language feature when sadge.
   std::stack<deferred> defer;
   #define DEFER(func) defer.push([&]() { func; })
 
-  Logging::info("GLFW initialization.");
-  glfwInit();
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-  auto window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-  DEFER(
-    glfwDestroyWindow(window); 
-    glfwTerminate();
-    Logging::info("GLFW destroyed");
-  );
+  auto options = parseLaunchOptions(argc, argv);
 
-  //Callback for when the window is resized and we need to rebuild the swapchains and framebuffers for the new extents.
+  GLFWwindow *window = nullptr;
   bool framebufferResized = false;
-  glfwSetWindowUserPointer(window, &framebufferResized);
-  glfwSetFramebufferSizeCallback(window, [](GLFWwindow *window, int width, int height) {
-    auto *resized = reinterpret_cast<bool *>(glfwGetWindowUserPointer(window));
-    *resized = true;
-    Logging::info("GLFW window was resized.");
-  });
+  if (!options.headless) {
+    Logging::info("GLFW initialization.");
+    glfwInit();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    DEFER(
+      glfwDestroyWindow(window); 
+      glfwTerminate();
+      Logging::info("GLFW destroyed");
+    );
+
+    //Callback for when the window is resized and we need to rebuild the swapchains and framebuffers for the new extents.
+    glfwSetWindowUserPointer(window, &framebufferResized);
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow *window, int width, int height) {
+      auto *resized = reinterpret_cast<bool *>(glfwGetWindowUserPointer(window));
+      *resized = true;
+      Logging::info("GLFW window was resized.");
+    });
+  } else {
+    Logging::info("Running headless for {} frames.", options.headlessFrames);
+  }
 
   Logging::info("Vulkan initialization.");
-  auto instance = Vulkan::createInstance();
+  auto instance = Vulkan::createInstance(options.headless);
   DEFER(
     vkDestroyInstance(instance, nullptr);
     Logging::info("Vulkan destroyed.");
@@ -66,7 +185,7 @@ int main() {
     return -1;
   }
 
-  auto surface = Vulkan::createSurface(instance, window);
+  auto surface = options.headless ? Vulkan::createHeadlessSurface(instance) : Vulkan::createSurface(instance, window);
   DEFER(
     vkDestroySurfaceKHR(instance, surface, nullptr)
   );
@@ -81,7 +200,54 @@ int main() {
     return -1;
   }
 
-  auto [logicalDevice, graphicsQueue] = Vulkan::createLogicalDevice(physicalDevice, requiredDeviceExtensions);
+  //Present wait is optional, without it frame pacing falls back to measured frame times.
+  std::vector<const char *> deviceExtensions = requiredDeviceExtensions;
+  Vulkan::PresentWaitFeatures presentWaitFeatures;
+  void *deviceFeatureChain = nullptr;
+  bool presentWaitSupported = Vulkan::supportsPresentWait(physicalDevice);
+  if (presentWaitSupported) {
+    deviceExtensions.insert(deviceExtensions.end(), Vulkan::presentWaitExtensions.begin(), Vulkan::presentWaitExtensions.end());
+    deviceFeatureChain = presentWaitFeatures.link(deviceFeatureChain);
+  }
+
+  bool creationFeedbackSupported = Vulkan::checkDeviceExtensionSupport(physicalDevice, Vulkan::pipelineCreationFeedbackExtensions);
+  if (creationFeedbackSupported) {
+    deviceExtensions.insert(deviceExtensions.end(), Vulkan::pipelineCreationFeedbackExtensions.begin(), Vulkan::pipelineCreationFeedbackExtensions.end());
+  }
+
+  Vulkan::ShaderObjectFeatures shaderObjectFeatures;
+  bool shaderObjectsEnabled = options.shaderObjects && Vulkan::supportsShaderObjects(physicalDevice);
+  if (options.shaderObjects && !shaderObjectsEnabled) {
+    Logging::warning("VK_EXT_shader_object isn't supported by this device, using pipelines.");
+  }
+  if (shaderObjectsEnabled) {
+    deviceExtensions.insert(deviceExtensions.end(), Vulkan::shaderObjectExtensions.begin(), Vulkan::shaderObjectExtensions.end());
+    deviceFeatureChain = shaderObjectFeatures.link(deviceFeatureChain);
+  }
+
+  Vulkan::DescriptorBufferFeatures descriptorBufferFeatures;
+  bool descriptorBuffersEnabled = options.descriptorBuffer && Vulkan::supportsDescriptorBuffers(physicalDevice);
+  if (options.descriptorBuffer && !descriptorBuffersEnabled) {
+    Logging::warning("VK_EXT_descriptor_buffer isn't supported by this device, using descriptor pools.");
+  }
+  if (descriptorBuffersEnabled) {
+    deviceExtensions.insert(deviceExtensions.end(), Vulkan::descriptorBufferExtensions.begin(), Vulkan::descriptorBufferExtensions.end());
+    deviceFeatureChain = descriptorBufferFeatures.link(deviceFeatureChain);
+  }
+
+  //The frame's uniform set is pushed into the command buffer when the device can, otherwise it comes from pools.
+  bool pushDescriptorsEnabled = !descriptorBuffersEnabled && !options.transientDescriptors && Vulkan::supportsPushDescriptors(physicalDevice);
+  if (pushDescriptorsEnabled) {
+    deviceExtensions.insert(deviceExtensions.end(), Vulkan::pushDescriptorExtensions.begin(), Vulkan::pushDescriptorExtensions.end());
+  }
+
+  //Block compressed KTX2 textures need the matching compression feature, enable whatever the device has.
+  auto enabledFeatures = Vulkan::textureCompressionFeatures(physicalDevice);
+  Logging::info("Texture compression: BC {}, ASTC {}.",
+    enabledFeatures.textureCompressionBC ? "supported" : "unavailable",
+    enabledFeatures.textureCompressionASTC_LDR ? "supported" : "unavailable");
+
+  auto [logicalDevice, graphicsQueue] = Vulkan::createLogicalDevice(physicalDevice, deviceExtensions, deviceFeatureChain, enabledFeatures);
   DEFER(
     vkDestroyDevice(logicalDevice, nullptr)
   );
@@ -91,6 +257,14 @@ int main() {
   }
 
   Vulkan::RenderingSwapChain swapChain;
+  swapChain.policy = swapChainPolicy;
+  swapChain.headlessExtent = {WIDTH, HEIGHT};
+  if (options.headless) {
+    swapChain.policy.presentMode = Vulkan::PresentPolicy::Immediate;
+  }
+  if (options.capture) {
+    swapChain.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
   swapChain.build(physicalDevice, logicalDevice, surface, window);
 
   auto renderPass = Vulkan::createRenderPass(logicalDevice, swapChain.format);
@@ -111,21 +285,129 @@ int main() {
     return -1;
   }
 
-  auto descriptorSetLayout = Descriptors::createPipelineDescriptorLayout(logicalDevice);
+  Vulkan::PipelineCache pipelineCache;
+  pipelineCache.load(physicalDevice, logicalDevice, PIPELINE_CACHE_PATH, creationFeedbackSupported);
   DEFER(
-    vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    pipelineCache.save(logicalDevice);
+    pipelineCache.destroy(logicalDevice)
   );
 
-  auto [graphicsPipelineLayout, graphicsPipeline] = Vulkan::createGraphicsPipeline(logicalDevice, renderPass, descriptorSetLayout);
+  //Descriptor set and pipeline layouts come from the shaders themselves, shared by every pipeline with the same interface.
+  Vulkan::ShaderReflectionCache shaderReflections;
   DEFER(
-    vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr)
+    shaderReflections.destroy(logicalDevice)
   );
-  if (graphicsPipelineLayout == VK_NULL_HANDLE ||
-      graphicsPipeline == VK_NULL_HANDLE) {
-    Logging::failure("Failed to create graphics pipeline.");
+
+  //With descriptor buffers every set is written straight into a mapped buffer, so no pools or sets at all.
+  Vulkan::DescriptorBufferFunctions descriptorBufferFunctions;
+  Vulkan::DescriptorBuffer descriptorBuffer;
+  DEFER(
+    descriptorBuffer.destroy(logicalDevice)
+  );
+  if (descriptorBuffersEnabled) {
+    if (!descriptorBufferFunctions.load(logicalDevice) ||
+      !descriptorBuffer.create(physicalDevice, logicalDevice, descriptorBufferFunctions, MAX_FRAMES_IN_FLIGHT)) {
+      Logging::failure("Failed to create the descriptor buffer.");
+      return -1;
+    }
+    shaderReflections.setLayoutFlags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    Logging::info("Binding descriptors from a descriptor buffer.");
+  }
+
+  Vulkan::PushDescriptorFunctions pushDescriptorFunctions;
+  if (pushDescriptorsEnabled && !pushDescriptorFunctions.load(logicalDevice)) {
+    Logging::warning("Continuing without push descriptors.");
+    pushDescriptorsEnabled = false;
+  }
+  if (pushDescriptorsEnabled) {
+    shaderReflections.usePushDescriptors(0);
+    Logging::info("Pushing the frame's descriptors with VK_KHR_push_descriptor.");
+  }
+  auto basicReflection = shaderReflections.reflectFiles({"Shaders/vert.spv", "Shaders/frag.spv"}, options.hotReload);
+  if (!basicReflection) {
+    Logging::failure("Failed to reflect the basic shaders.");
+    return -1;
+  }
+  if (!basicReflection->matches(Vulkan::VertexLayout::streams<Descriptors::VertexPosition, Descriptors::VertexAttributes>())) {
+    Logging::failure("The split vertex streams don't match the basic vertex shader inputs.");
+    return -1;
+  }
+
+  auto graphicsPipelineLayout = shaderReflections.pipelineLayout(logicalDevice, *basicReflection);
+  if (graphicsPipelineLayout == VK_NULL_HANDLE) {
+    Logging::failure("Failed to create graphics pipeline layout.");
     return -1;
   }
+  auto descriptorSetLayouts = shaderReflections.descriptorSetLayouts(logicalDevice, *basicReflection);
+  if (descriptorSetLayouts.empty()) {
+    Logging::failure("The basic shaders declare no descriptor sets.");
+    return -1;
+  }
+  auto descriptorSetLayout = descriptorSetLayouts.front();
+
+  //Packed in the order of set 0's bindings, see DescriptorTemplates.cc.
+  struct FrameBindings {
+    VkDescriptorBufferInfo uniforms;
+  };
+  Vulkan::DescriptorTemplate frameTemplate;
+  if (pushDescriptorsEnabled) {
+    frameTemplate = Vulkan::createPushDescriptorTemplate(
+      logicalDevice, basicReflection->sets.front().bindings, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0);
+    if (!frameTemplate.valid() || frameTemplate.dataSize != sizeof(FrameBindings)) {
+      Logging::failure("Failed to create the frame's push descriptor template.");
+      return -1;
+    }
+  }
+  DEFER(
+    frameTemplate.destroy(logicalDevice)
+  );
+
+  //Pipelines compile on worker threads, frames render without them until they're ready.
+  Vulkan::PipelineCompiler pipelineCompiler;
+  pipelineCompiler.preferDiskShaders = options.hotReload;
+  if (descriptorBuffersEnabled) {
+    pipelineCompiler.pipelineFlags = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+  }
+  pipelineCompiler.start(logicalDevice, pipelineCache);
+  DEFER(
+    pipelineCompiler.destroy()
+  );
+
+  //Pipelines are created on first use and shared by every identical state.
+  Vulkan::PipelineStateCache pipelineStates;
+  pipelineStates.create(pipelineCompiler);
+  DEFER(
+    pipelineStates.logStatistics()
+  );
+
+  Vulkan::ShaderObjectFunctions shaderObjectFunctions;
+  Vulkan::ShaderObjectCache shaderObjectCache;
+  if (shaderObjectsEnabled) {
+    if (!shaderObjectFunctions.load(logicalDevice)) {
+      Logging::failure("Failed to load the shader object functions.");
+      return -1;
+    }
+    shaderObjectCache.create(logicalDevice, shaderObjectFunctions);
+    DEFER(
+      shaderObjectCache.destroy()
+    );
+    Logging::info("Rendering with shader objects.");
+  }
+
+  Shaders::ShaderWatcher shaderWatcher;
+  if (options.hotReload && shaderWatcher.start(hotReloadShaders)) {
+    DEFER(
+      shaderWatcher.stop()
+    );
+  }
+
+  Vulkan::PipelineState basicPipelineState;
+  basicPipelineState.name = "basic";
+  basicPipelineState.vertexShader = "Shaders/vert.spv";
+  basicPipelineState.fragmentShader = "Shaders/frag.spv";
+  basicPipelineState.targets.color = {swapChain.format};
+  basicPipelineState.layout = graphicsPipelineLayout;
+  basicPipelineState.renderPass = renderPass;
 
   auto commandPool = Vulkan::createCommandPool(physicalDevice, logicalDevice);
   DEFER(
@@ -136,6 +418,28 @@ int main() {
     return -1;
   }
 
+  Vulkan::TextureLoader textureLoader;
+  if (!textureLoader.start(physicalDevice, logicalDevice, graphicsQueue)) {
+    Logging::failure("Failed to start the texture loader.");
+    return -1;
+  }
+  DEFER(
+    textureLoader.destroy()
+  );
+  //Only used for RGBA32F textures on devices that can't filter it. The downsample shader isn't watched for hot
+  //reload, so it always comes from the embedded copy rather than a Shaders/downsample.spv that may not exist.
+  textureLoader.enableComputeMipmaps(shaderReflections, pipelineCache, false,
+    pushDescriptorsEnabled ? &pushDescriptorFunctions : nullptr);
+  std::vector<Vulkan::TextureHandle> textures;
+  std::error_code textureDirectoryError;
+  for (const auto& entry : std::filesystem::directory_iterator(options.textureDirectory, textureDirectoryError)) {
+    if (entry.is_regular_file()) {
+      textures.push_back(textureLoader.load(entry.path()));
+    }
+  }
+  bool texturesLoading = !textures.empty();
+  auto texturesBegin = std::chrono::steady_clock::now();
+
   auto commandBuffers = Vulkan::createCommandBuffers(logicalDevice, commandPool, MAX_FRAMES_IN_FLIGHT);
   for (auto &commandBuffer : commandBuffers) {
     if (commandBuffer == VK_NULL_HANDLE) {
@@ -144,6 +448,21 @@ int main() {
     }
   }
 
+  Vulkan::FrameReadback frameReadback;
+  bool captureEnabled = options.capture && (swapChain.imageUsage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  if (options.capture && !captureEnabled) {
+    Logging::warning("Swapchain images can't be copied from on this surface, frame capture disabled.");
+  }
+  if (captureEnabled) {
+    if (!frameReadback.create(physicalDevice, logicalDevice, commandPool, MAX_FRAMES_IN_FLIGHT, swapChain.format, options.captureConfig)) {
+      Logging::failure("Failed to create frame readback.");
+      return -1;
+    }
+    DEFER(
+      frameReadback.destroy(logicalDevice)
+    );
+  }
+
   auto maybeSynchronizers = Vulkan::createFrameSyncObjects(logicalDevice, MAX_FRAMES_IN_FLIGHT);
   if (!maybeSynchronizers) {
     Logging::failure("Failed to create synchronization objects.");
@@ -156,6 +475,17 @@ int main() {
     }
   );
 
+  Vulkan::FramePacer framePacer;
+  auto pacingConfig = framePacingConfig;
+  if (options.headless) {
+    pacingConfig.mode = Vulkan::PacingMode::Uncapped;
+  }
+  framePacer.create(physicalDevice, logicalDevice, MAX_FRAMES_IN_FLIGHT, pacingConfig, presentWaitSupported);
+  DEFER(
+    framePacer.destroy(logicalDevice)
+  );
+  Logging::info("Frame pacing: present wait {}.", framePacer.presentWaitEnabled ? "enabled" : "unavailable");
+
   auto indexedVertexBuffer = Vulkan::StagedBuffer{};
   indexedVertexBuffer.allocate(physicalDevice, logicalDevice, INDEXED_VERTEX_BUFFER_STATIC_ALLOCATION_SIZE);
   indexedVertexBuffer.map();
@@ -164,17 +494,27 @@ int main() {
     indexedVertexBuffer.free();
   );
 
-  auto descriptorPool = Descriptors::createDescriptorPool(logicalDevice, MAX_FRAMES_IN_FLIGHT);
+  //Only the pool path allocates sets, descriptor buffers and push descriptors need no pools. Long lived sets are
+  //looked up by their contents, so identical bindings reuse one set instead of being rewritten. With
+  //--transient-descriptors the frame's sets are allocated fresh instead and released together when the frame
+  //comes round again.
+  bool descriptorPoolsEnabled = !descriptorBuffersEnabled && !pushDescriptorsEnabled;
+  bool transientDescriptors = descriptorPoolsEnabled && options.transientDescriptors;
+  Descriptors::DescriptorSetCache descriptorSetCache;
+  Descriptors::FrameDescriptors frameDescriptors;
+  if (transientDescriptors) {
+    frameDescriptors.create(logicalDevice, MAX_FRAMES_IN_FLIGHT, 16);
+  } else if (descriptorPoolsEnabled) {
+    descriptorSetCache.create(logicalDevice);
+  }
   DEFER(
-    vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+    descriptorSetCache.destroy(logicalDevice);
+    frameDescriptors.destroy(logicalDevice);
   );
 
-  auto descriptorSets = Descriptors::createDescriptorSets(logicalDevice, descriptorSetLayout, descriptorPool, MAX_FRAMES_IN_FLIGHT);
-
   std::array<Vulkan::UniformBuffer, MAX_FRAMES_IN_FLIGHT> uniformBuffers;
   for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    uniformBuffers[i].allocate(physicalDevice, logicalDevice);
-    uniformBuffers[i].bindDescriptor(logicalDevice, descriptorSets[i]);
+    uniformBuffers[i].allocate(physicalDevice, logicalDevice, descriptorBuffersEnabled);
   }
   DEFER(
     for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
@@ -192,18 +532,114 @@ int main() {
   std::vector<uint16_t> indices = {
     0, 1, 2, 2, 3, 0
   };
+  auto vertexStreams = Descriptors::splitVertices(vertices);
 
   uint32_t currentFrame = 0;
   int frameCount = 0;
   auto lastTime = std::chrono::high_resolution_clock::now();
 
+  Profiling::FrameStatistics frameStatistics;
+  uint32_t framesRendered = 0;
+  if (options.headless) {
+    frameStatistics.reserve(options.headlessFrames);
+  }
+  auto frameBegin = std::chrono::steady_clock::now();
+
   // PRIMARY LOOP
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+  while (options.headless ? framesRendered < options.headlessFrames : !glfwWindowShouldClose(window)) {
+    //Sleep before sampling input so the input is as fresh as possible when the frame is built.
+    uint32_t previousFrame = (currentFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+    framePacer.waitForFrameStart(logicalDevice, swapChain.vulkanSwapChain, synchronizers[previousFrame].inFlightFence);
+    if (window != nullptr) {
+      glfwPollEvents();
+
+      for (auto [key, presentPolicy] : presentPolicyKeys) {
+        if (glfwGetKey(window, key) == GLFW_PRESS) {
+          swapChain.setPolicy({presentPolicy, swapChain.policy.imageCount});
+        }
+      }
+    }
+
+    if (options.hotReload) {
+      for (const auto &spirv : shaderWatcher.takeRebuilt()) {
+        pipelineCompiler.reload(spirv);
+        shaderObjectCache.reload(spirv, framesRendered);
+      }
+      pipelineCompiler.swapReloaded(framesRendered, MAX_FRAMES_IN_FLIGHT);
+      shaderObjectCache.collectRetired(framesRendered, MAX_FRAMES_IN_FLIGHT);
+    }
+
+    VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+    Vulkan::ShaderObjectDraw shaderObjectDraw;
+    if (shaderObjectsEnabled) {
+      shaderObjectDraw.functions = &shaderObjectFunctions;
+      shaderObjectDraw.shaders = shaderObjectCache.request(basicPipelineState, descriptorSetLayouts, basicReflection->pushConstants, options.hotReload);
+      shaderObjectDraw.state = &basicPipelineState;
+      if (!shaderObjectDraw.shaders.valid()) {
+        Logging::failure("Failed to create shader objects.");
+        return -1;
+      }
+    } else {
+      auto basicPipeline = pipelineStates.request(basicPipelineState);
+      if (pipelineCompiler.status(basicPipeline) == Vulkan::PipelineStatus::Failed) {
+        Logging::failure("Failed to create graphics pipeline.");
+        return -1;
+      }
+      graphicsPipeline = pipelineCompiler.get(basicPipeline);
+    }
+
+    //This frame's last submission has to be finished before its uniform buffer and descriptors are rewritten.
+    vkWaitForFences(logicalDevice, 1, &synchronizers[currentFrame].inFlightFence, VK_TRUE, UINT64_MAX);
+    Descriptors::DescriptorAllocator* frameAllocator = nullptr;
+    if (transientDescriptors) {
+      frameAllocator = &frameDescriptors.beginFrame(logicalDevice, currentFrame);
+    } else if (descriptorPoolsEnabled) {
+      descriptorSetCache.evict(framesRendered, MAX_FRAMES_IN_FLIGHT);
+    }
+
+    textureLoader.update();
+    if (texturesLoading && !textureLoader.busy()) {
+      texturesLoading = false;
+      auto loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - texturesBegin).count();
+      uint32_t loaded = 0;
+      for (auto handle : textures) {
+        if (textureLoader.get(handle) != nullptr) {
+          loaded++;
+        }
+      }
+      Logging::info("Loaded {} of {} textures in {:.1f} ms.", loaded, textures.size(), loadTime);
+    }
 
     Vulkan::UniformBuffer currentUniformBuffer = uniformBuffers[currentFrame];
     currentUniformBuffer.updateUniformBuffer(swapChain.extent);
 
+    //Timed separately so the descriptor backends can be compared in headless runs. The set cache and descriptor
+    //buffer paths only write descriptors on a miss, so steady state frames compare one cache hit against another.
+    //Transient sets are allocated and written every frame.
+    auto descriptorBegin = std::chrono::steady_clock::now();
+    std::optional<Vulkan::DescriptorBufferBinding> descriptorBufferBinding;
+    std::optional<Vulkan::PushDescriptorBinding> pushDescriptorBinding;
+    if (descriptorBuffersEnabled) {
+      descriptorBuffer.beginFrame(currentFrame);
+      descriptorBufferBinding = descriptorBuffer.write(logicalDevice, descriptorSetLayout, currentUniformBuffer.descriptorWrites());
+    } else if (pushDescriptorsEnabled) {
+      FrameBindings bindings{{currentUniformBuffer.buffer, 0, sizeof(Descriptors::UniformBufferObject)}};
+      pushDescriptorBinding = Vulkan::PushDescriptorBinding::of(pushDescriptorFunctions, frameTemplate, bindings);
+    } else if (transientDescriptors) {
+      currentUniformBuffer.descriptorSet = frameAllocator->allocate(logicalDevice, descriptorSetLayout);
+      if (currentUniformBuffer.descriptorSet != VK_NULL_HANDLE) {
+        currentUniformBuffer.descriptorWrites().apply(logicalDevice, currentUniformBuffer.descriptorSet);
+      }
+    } else {
+      currentUniformBuffer.descriptorSet = descriptorSetCache.get(
+        logicalDevice, descriptorSetLayout, currentUniformBuffer.descriptorWrites(), framesRendered);
+    }
+    if (!descriptorBufferBinding && !pushDescriptorBinding && currentUniformBuffer.descriptorSet == VK_NULL_HANDLE) {
+      Logging::failure("Failed to get the frame's descriptors.");
+      return -1;
+    }
+    auto descriptorTime = std::chrono::steady_clock::now() - descriptorBegin;
+
     bool frameSuccessful = Vulkan::drawFrame(
       physicalDevice, 
       logicalDevice, 
@@ -216,7 +652,13 @@ int main() {
       synchronizers[currentFrame],
       indexedVertexBuffer,
       currentUniformBuffer,
-      framebufferResized
+      framebufferResized,
+      framePacer,
+      currentFrame,
+      captureEnabled ? &frameReadback : nullptr,
+      shaderObjectsEnabled ? &shaderObjectDraw : nullptr,
+      descriptorBufferBinding ? &descriptorBufferBinding.value() : nullptr,
+      pushDescriptorBinding ? &pushDescriptorBinding.value() : nullptr
     );
 
     if (!frameSuccessful) {
@@ -225,9 +667,17 @@ int main() {
     }
     currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 
-    indexedVertexBuffer.put(vertices, indices);
+    indexedVertexBuffer.putStreams<Descriptors::VertexPosition, Descriptors::VertexAttributes>(vertexStreams.positions, vertexStreams.attributes, indices);
     indexedVertexBuffer.stagingToBuffer(graphicsQueue, commandPool);
 
+    auto frameEnd = std::chrono::steady_clock::now();
+    if (options.headless) {
+      frameStatistics.record(frameEnd - frameBegin, framePacer.takeGpuFrameTime());
+      frameStatistics.recordDescriptors(descriptorTime);
+    }
+    frameBegin = frameEnd;
+    framesRendered++;
+
     frameCount++;
     auto currentTime = std::chrono::high_resolution_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(currentTime - lastTime).count();
@@ -243,6 +693,12 @@ int main() {
 
   vkDeviceWaitIdle(logicalDevice);
 
+  if (options.headless) {
+    frameStatistics.report(descriptorBuffersEnabled ? "Headless (descriptor buffer)" :
+      pushDescriptorsEnabled ? "Headless (push descriptors)" :
+      transientDescriptors ? "Headless (per frame descriptor pools)" : "Headless (descriptor set cache)");
+  }
+
   while (!defer.empty()) {
     auto deferred_func = defer.top();
     deferred_func();
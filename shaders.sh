@@ -1,4 +1,5 @@
 #!/bin/bash
 
 glslc Shaders/basic.vert -o Shaders/vert.spv
-glslc Shaders/basic.frag -o Shaders/frag.spv
\ No newline at end of file
+glslc Shaders/basic.frag -o Shaders/frag.spv
+glslc Shaders/downsample.comp -o Shaders/downsample.spv
\ No newline at end of file